@@ -0,0 +1,219 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Created by Hongbo Li <lihb2113@outlook.com>
+ */
+#include "mempool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+/*************************************************************************
+*************************************************************************/
+
+/*
+ * 1. 伪共享测试：每个线程反复写自己的单元，单元由同一次批量申请得到，在位图中相邻。
+ *    紧凑布局下多个线程的单元落在同一缓存行，缓存行对齐后各占一行。
+ * 2. 扩展性测试：线程数按1、2、4...翻倍到指定线程数，每个线程循环申请释放一批单元，
+ *    分别测试默认模式与MEMPOOL_MAGAZINE模式的吞吐。
+ * 用法：mpbench [线程数] [每线程写次数] [每线程申请释放轮数]
+ */
+
+#define DEF_THREADS     4U
+#define DEF_LOOPS       50000000UL
+#define DEF_ROUNDS      1000000UL
+#define MAX_THREADS     64U
+#define UNIT_SIZE       16U
+#define SCALE_BATCH     8U      /* 每轮申请释放的单元数 */
+#define SCALE_COUNT     (MAX_THREADS * SCALE_BATCH * 16)
+
+typedef struct
+{
+    volatile uint64_t   *cell;
+    uint64_t            loops;
+}_bench_arg_t;
+
+typedef struct
+{
+    mempool_t           *pool;
+    uint64_t            rounds;
+    uint64_t            fail;
+}_scale_arg_t;
+
+static uint64_t _now_ms(void)
+{
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void *_bench_svc(void *args)
+{
+    _bench_arg_t *arg = (_bench_arg_t *)args;
+    for (uint64_t i = 0; i < arg->loops; i++)
+    {
+        (*arg->cell)++;
+    }
+
+    return NULL;
+}
+
+static int _bench_run(const char *name, uint32_t flags, uint32_t threads, uint64_t loops)
+{
+    mempool_t *pool = mempool_create_ex(UNIT_SIZE, threads, NULL, flags);
+    if (NULL == pool)
+    {
+        printf("%-10s create mempool failed\n", name);
+        return -1;
+    }
+
+    void *cell[MAX_THREADS] = {NULL};
+    if (threads != mempool_alloc_bulk(pool, threads, cell))
+    {
+        printf("%-10s alloc units failed\n", name);
+        mempool_destroy(pool);
+        return -1;
+    }
+
+    mempool_info_t info;
+    mempool_getinfo(pool, &info);
+
+    pthread_t tid[MAX_THREADS];
+    _bench_arg_t arg[MAX_THREADS];
+    uint64_t begin = _now_ms();
+    uint32_t i = 0;
+    for (; i < threads; i++)
+    {
+        arg[i].cell = (volatile uint64_t *)cell[i];
+        *arg[i].cell = 0;
+        arg[i].loops = loops;
+        if (0 != pthread_create(&tid[i], NULL, _bench_svc, &arg[i]))
+        {
+            printf("%-10s create thread failed\n", name);
+            break;
+        }
+    }
+
+    for (uint32_t j = 0; j < i; j++)
+    {
+        (void)pthread_join(tid[j], NULL);
+    }
+
+    printf("%-10s stride=%-4u threads=%-3u %8lums\n",
+            name, info.fix_size, i, (unsigned long)(_now_ms() - begin));
+
+    mempool_free_bulk(pool, threads, cell);
+    mempool_destroy(pool);
+    return (i == threads) ? 0 : -1;
+}
+
+/*************************************************************************
+*************************************************************************/
+
+static void *_scale_svc(void *args)
+{
+    _scale_arg_t *arg = (_scale_arg_t *)args;
+    void *unit[SCALE_BATCH];
+    for (uint64_t i = 0; i < arg->rounds; i++)
+    {
+        for (uint32_t j = 0; j < SCALE_BATCH; j++)
+        {
+            unit[j] = mempool_alloc(arg->pool);
+        }
+
+        for (uint32_t j = 0; j < SCALE_BATCH; j++)
+        {
+            if (NULL == unit[j])
+            {
+                arg->fail++;
+                continue;
+            }
+
+            mempool_free(arg->pool, unit[j]);
+        }
+    }
+
+    return NULL;
+}
+
+static int _scale_run(const char *name, uint32_t flags, uint32_t threads, uint64_t rounds)
+{
+    mempool_t *pool = mempool_create_ex(UNIT_SIZE, SCALE_COUNT, NULL, flags);
+    if (NULL == pool)
+    {
+        printf("%-10s create mempool failed\n", name);
+        return -1;
+    }
+
+    pthread_t tid[MAX_THREADS];
+    _scale_arg_t arg[MAX_THREADS];
+    uint64_t begin = _now_ms();
+    uint32_t i = 0;
+    for (; i < threads; i++)
+    {
+        arg[i].pool = pool;
+        arg[i].rounds = rounds;
+        arg[i].fail = 0;
+        if (0 != pthread_create(&tid[i], NULL, _scale_svc, &arg[i]))
+        {
+            printf("%-10s create thread failed\n", name);
+            break;
+        }
+    }
+
+    uint64_t fail = 0;
+    for (uint32_t j = 0; j < i; j++)
+    {
+        (void)pthread_join(tid[j], NULL);
+        fail += arg[j].fail;
+    }
+
+    /* 每次申请与释放各算一次操作 */
+    uint64_t elapsed = _now_ms() - begin;
+    uint64_t ops = (uint64_t)i * rounds * SCALE_BATCH * 2;
+    printf("%-10s threads=%-3u %8lums %10lu ops/ms fail=%lu\n",
+            name, i, (unsigned long)elapsed,
+            (unsigned long)((0 == elapsed) ? ops : ops / elapsed), (unsigned long)fail);
+
+    mempool_destroy(pool);
+    return (i == threads) ? 0 : -1;
+}
+
+static int _scale_sweep(uint32_t threads, uint64_t rounds)
+{
+    int ret = 0;
+    for (uint32_t n = 1; ; n <<= 1)
+    {
+        n = (n > threads) ? threads : n;
+        ret |= _scale_run("default", 0, n, rounds);
+        ret |= _scale_run("magazine", MEMPOOL_MAGAZINE, n, rounds);
+        if (n == threads)
+        {
+            break;
+        }
+    }
+
+    return ret;
+}
+
+/*************************************************************************
+*************************************************************************/
+
+int main(int argc, char **argv)
+{
+    uint32_t threads = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 10) : DEF_THREADS;
+    uint64_t loops = (argc > 2) ? strtoull(argv[2], NULL, 10) : DEF_LOOPS;
+    uint64_t rounds = (argc > 3) ? strtoull(argv[3], NULL, 10) : DEF_ROUNDS;
+    if ((0 == threads) || (threads > MAX_THREADS))
+    {
+        printf("threads must be in [1, %u]\n", MAX_THREADS);
+        return 1;
+    }
+
+    int ret = _bench_run("packed", 0, threads, loops);
+    ret |= _bench_run("cacheline", MEMPOOL_CACHEALIGN, threads, loops);
+    ret |= _scale_sweep(threads, rounds);
+    return (0 == ret) ? 0 : 1;
+}
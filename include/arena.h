@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Created by Hongbo Li <lihb2113@outlook.com>
+ */
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include "mempool.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*************************************************************************
+*************************************************************************/
+
+/*
+ * 区域分配器：在块内顺序分配，不能单独释放，通过回退到标记点或重置整体释放。
+ * 块来自mempool，用尽时自动申请新块(mempool耗尽时退化为malloc)，
+ * 超过块大小的申请单独malloc。arena本身不加锁，只能由一个线程/lwt使用。
+ */
+#define ARENA_ALIGN         16U             /* 分配的对齐值 */
+#define ARENA_CHUNK_SIZE    (64U << 10)     /* 内部块池的块大小 */
+
+typedef struct arena arena_t;
+
+/* 标记点，回退时释放标记之后的所有分配 */
+typedef struct
+{
+    void        *chunk;
+    char        *ptr;
+    void        *large;
+}arena_mark_t;
+
+/*************************************************************************
+*************************************************************************/
+
+/* pool的单元作为块，需按ARENA_ALIGN对齐(MEMPOOL_ALIGN)；
+ * 为NULL时使用内部共享的块池(在mpstat中名为arena) */
+arena_t *arena_create   (mempool_t *pool);
+void    arena_destroy   (arena_t *arena);
+
+void    *arena_alloc    (arena_t *arena, size_t size);
+
+/* mark必须来自同一arena，且不早于上次回退到的位置 */
+void    arena_mark      (arena_t *arena, arena_mark_t *mark);
+void    arena_rewind    (arena_t *arena, const arena_mark_t *mark);
+
+/* 释放全部分配，保留首块 */
+void    arena_reset     (arena_t *arena);
+
+/*************************************************************************
+*************************************************************************/
+
+/* 当前线程的arena，首次调用时创建，线程退出时销毁 */
+arena_t *arena_thread   (void);
+
+/* 当前lwt的arena，首次调用时创建，lwt结束并执行完fini后销毁；
+ * 在fini中调用时返回已结束lwt的arena(未创建过时同下)，不在lwt中调用时返回arena_thread() */
+arena_t *arena_lwt      (void);
+
+/*************************************************************************
+*************************************************************************/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -84,6 +84,11 @@ static inline int32_t atomic_s32_inc(int32_t *var)
     return __atomic_add_fetch(var, 1, __ATOMIC_SEQ_CST);
 }
 
+static inline int32_t atomic_s32_add(int32_t *augend, int32_t addend)
+{
+    return __atomic_add_fetch(augend, addend, __ATOMIC_SEQ_CST);
+}
+
 static inline int32_t atomic_s32_dec(int32_t *var)
 {
     return __atomic_sub_fetch(var, 1, __ATOMIC_SEQ_CST);
@@ -117,6 +122,16 @@ static inline uint32_t atomic_u32_dec(uint32_t *var)
     return __atomic_sub_fetch(var, 1, __ATOMIC_SEQ_CST);
 }
 
+static inline uint32_t atomic_u32_add(uint32_t *augend, uint32_t addend)
+{
+    return __atomic_add_fetch(augend, addend, __ATOMIC_SEQ_CST);
+}
+
+static inline uint32_t atomic_u32_sub(uint32_t *minuend, uint32_t subtrahend)
+{
+    return __atomic_sub_fetch(minuend, subtrahend, __ATOMIC_SEQ_CST);
+}
+
 static inline uint32_t atomic_u32_fetch(uint32_t *var)
 {
     return __atomic_load_n(var, __ATOMIC_SEQ_CST);
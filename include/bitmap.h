@@ -133,14 +133,33 @@ static inline int bmap_testclear_bit(int siNr, void *pAddr)
 
 #define RECOMMEND_BITS  (256)
 
+/* 无锁模式：底层位原子占用/释放，上层汇总位延迟更新 */
+#define BITMAP_LOCKFREE (0x1U)
+
 typedef struct bitmap bitmap_t;
 
 bitmap_t *bitmap_create(int bit_count);
+bitmap_t *bitmap_create_ex(int bit_count, uint32_t flags);
 void    bitmap_destroy(bitmap_t *bitmap);
 
 int bitmap_allocbit(bitmap_t *bitmap, int *bit);
 int bitmap_freebit(bitmap_t *bitmap, int bit);
 
+/* 批量申请最多n个位，一次加锁并尽量整字占用，返回实际申请的个数 */
+int bitmap_allocbits(bitmap_t *bitmap, int *bits, int n);
+/* 批量释放，任一位重复释放或越界时返回BIT_FAIL(其余位仍会释放) */
+int bitmap_freebits(bitmap_t *bitmap, const int *bits, int n);
+
+typedef struct
+{
+    int         total;      /* 位总数 */
+    int         used;       /* 已占用位数 */
+    uint64_t    contended;  /* 加锁竞争次数，无锁模式下为抢占失败次数 */
+}bitmap_info_t;
+
+void bitmap_getinfo(bitmap_t *bitmap, bitmap_info_t *info);
+void bitmap_resetinfo(bitmap_t *bitmap);
+
 #ifdef __cplusplus
 }
 #endif
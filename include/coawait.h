@@ -0,0 +1,311 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Created by Hongbo Li <lihb2113@outlook.com>
+ */
+#ifndef __COAWAIT_H__
+#define __COAWAIT_H__
+
+/*
+ * 基于comgr调度的C++20无栈协程前端，需以-std=c++20编译(cmake -DCOAWAIT=ON)。
+ * 协程帧的每次恢复通过comgr_post投递到worker执行，与lwt共用worker，
+ * 帧只占用局部变量所需的堆空间，切换时不交换寄存器上下文。
+ * 协程中不能调用cosem等lwt接口，阻塞等待需使用这里的可等待类型。
+ */
+
+#if defined(__cplusplus) && (__cplusplus >= 202002L)
+
+#include "coroutine.h"
+
+#include <coroutine>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+namespace co {
+
+/*************************************************************************
+*************************************************************************/
+
+/* 所有可等待类型的公共部分：记录挂起的协程及其恢复时使用的job */
+struct waiter
+{
+    comgr_t                 *mgr = nullptr;
+    std::coroutine_handle<> handle;
+    void                    *owner = nullptr;   /* 所属的可等待对象 */
+    waiter                  *next = nullptr;
+    cojob_t                 job;
+
+    /* 投递到mgr的worker上恢复，ms为0表示立即恢复 */
+    int resume(uint32_t ms = 0);
+};
+
+class waitlist
+{
+public:
+    bool empty() const { return nullptr == head_; }
+    void push(waiter *w);
+    waiter *pop();
+
+private:
+    waiter  *head_ = nullptr;
+    waiter  *tail_ = nullptr;
+};
+
+/*************************************************************************
+*************************************************************************/
+
+/* 分离运行的协程，由spawn启动，结束时自行释放帧 */
+class task
+{
+public:
+    struct promise_type
+    {
+        comgr_t *mgr = nullptr;
+        waiter  start;
+
+        task get_return_object() noexcept
+        {
+            return task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept;
+    };
+
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    task(task &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+    task(const task &) = delete;
+    task &operator=(const task &) = delete;
+    task &operator=(task &&) = delete;
+
+    ~task()
+    {
+        /* 未被spawn的协程帧在这里释放 */
+        if (handle_)
+        {
+            handle_.destroy();
+        }
+    }
+
+private:
+    explicit task(handle_type handle) noexcept : handle_(handle) {}
+
+    friend int spawn(comgr_t *mgr, task &&t);
+
+    handle_type handle_;
+};
+
+/* 将协程投递到mgr上运行，失败返回-1 */
+int spawn(comgr_t *mgr, task &&t);
+
+/*************************************************************************
+*************************************************************************/
+
+/* 挂起ms毫秒后在当前mgr上恢复，ms为0表示让出worker */
+class sleep
+{
+public:
+    explicit sleep(uint32_t ms) noexcept : ms_(ms) {}
+
+    bool await_ready() const noexcept { return false; }
+    void await_resume() const noexcept {}
+
+    bool await_suspend(task::handle_type handle) noexcept
+    {
+        waiter_.mgr = handle.promise().mgr;
+        waiter_.handle = handle;
+        return (0 == waiter_.resume(ms_));
+    }
+
+private:
+    uint32_t    ms_;
+    waiter      waiter_;
+};
+
+inline sleep yield() noexcept
+{
+    return sleep(0);
+}
+
+/*************************************************************************
+*************************************************************************/
+
+/* 计数信号量，up可在任意线程/lwt中调用，down只能在task中co_await */
+class semaphore
+{
+public:
+    explicit semaphore(int32_t val = 0) noexcept : val_(val) {}
+    semaphore(const semaphore &) = delete;
+    semaphore &operator=(const semaphore &) = delete;
+
+    void up();
+
+    class awaiter
+    {
+    public:
+        explicit awaiter(semaphore &sem) noexcept : sem_(sem) {}
+
+        bool await_ready() const noexcept { return false; }
+        void await_resume() const noexcept {}
+        bool await_suspend(task::handle_type handle);
+
+    private:
+        semaphore   &sem_;
+        waiter      waiter_;
+    };
+
+    awaiter down() noexcept
+    {
+        return awaiter(*this);
+    }
+
+private:
+    std::mutex  lock_;
+    int32_t     val_;
+    waitlist    waiters_;
+};
+
+/*************************************************************************
+*************************************************************************/
+
+/* 有界通道，capacity为0时收发双方直接交接 */
+template <typename T>
+class channel
+{
+public:
+    explicit channel(size_t capacity = 0) : capacity_(capacity) {}
+    channel(const channel &) = delete;
+    channel &operator=(const channel &) = delete;
+
+    class sender
+    {
+    public:
+        sender(channel &chan, T &&value) : chan_(chan), value_(std::move(value)) {}
+
+        bool await_ready() const noexcept { return false; }
+        void await_resume() const noexcept {}
+
+        bool await_suspend(task::handle_type handle)
+        {
+            channel &chan = chan_;
+            std::unique_lock<std::mutex> guard(chan.lock_);
+
+            /* 1. 有等待的接收者时直接交给它 */
+            if (!chan.receivers_.empty())
+            {
+                receiver *recv = static_cast<receiver *>(chan.receivers_.pop()->owner);
+                recv->value_.emplace(std::move(value_));
+                guard.unlock();
+                (void)recv->waiter_.resume();
+                return false;
+            }
+
+            /* 2. 缓冲区未满时放入缓冲区 */
+            if (chan.buffer_.size() < chan.capacity_)
+            {
+                chan.buffer_.push_back(std::move(value_));
+                return false;
+            }
+
+            /* 3. 挂起等待接收者，解锁后不能再访问自身 */
+            waiter_.mgr = handle.promise().mgr;
+            waiter_.handle = handle;
+            waiter_.owner = this;
+            chan.senders_.push(&waiter_);
+            return true;
+        }
+
+    private:
+        friend class channel;
+
+        channel     &chan_;
+        T           value_;
+        waiter      waiter_;
+    };
+
+    class receiver
+    {
+    public:
+        explicit receiver(channel &chan) noexcept : chan_(chan) {}
+
+        bool await_ready() const noexcept { return false; }
+        T await_resume() { return std::move(*value_); }
+
+        bool await_suspend(task::handle_type handle)
+        {
+            channel &chan = chan_;
+            std::unique_lock<std::mutex> guard(chan.lock_);
+
+            /* 1. 优先从缓冲区取，并将一个等待的发送者补入缓冲区 */
+            if (!chan.buffer_.empty())
+            {
+                value_.emplace(std::move(chan.buffer_.front()));
+                chan.buffer_.pop_front();
+                if (chan.senders_.empty())
+                {
+                    return false;
+                }
+
+                sender *send = static_cast<sender *>(chan.senders_.pop()->owner);
+                chan.buffer_.push_back(std::move(send->value_));
+                guard.unlock();
+                (void)send->waiter_.resume();
+                return false;
+            }
+
+            /* 2. 无缓冲时直接从等待的发送者取 */
+            if (!chan.senders_.empty())
+            {
+                sender *send = static_cast<sender *>(chan.senders_.pop()->owner);
+                value_.emplace(std::move(send->value_));
+                guard.unlock();
+                (void)send->waiter_.resume();
+                return false;
+            }
+
+            /* 3. 挂起等待发送者 */
+            waiter_.mgr = handle.promise().mgr;
+            waiter_.handle = handle;
+            waiter_.owner = this;
+            chan.receivers_.push(&waiter_);
+            return true;
+        }
+
+    private:
+        friend class channel;
+
+        channel             &chan_;
+        std::optional<T>    value_;
+        waiter              waiter_;
+    };
+
+    sender send(T value)
+    {
+        return sender(*this, std::move(value));
+    }
+
+    receiver recv() noexcept
+    {
+        return receiver(*this);
+    }
+
+private:
+    std::mutex      lock_;
+    size_t          capacity_;
+    std::deque<T>   buffer_;
+    waitlist        senders_;
+    waitlist        receivers_;
+};
+
+/*************************************************************************
+*************************************************************************/
+
+} // namespace co
+
+#endif
+
+#endif
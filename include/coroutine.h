@@ -2,6 +2,7 @@
 /*
  * Created by Hongbo Li <lihb2113@outlook.com>
  */
+#include "threadpool.h"
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -16,6 +17,20 @@ typedef void (*coroutine_func)(void *args);
 
 typedef struct coroutine_mgr comgr_t;
 
+#define COSCOPE_SIZE    8
+#define COJOB_SIZE      10
+#define COSEL_TIMEOUT   (-2)
+
+/* 共享栈模式：lwt运行在所属worker的共享栈上，挂起时按实际使用量拷贝到堆中保存，
+ * 适用于大量空闲lwt；会被其他lwt或线程访问的cosem/coscope不能分配在lwt栈上，
+ * 否则初始化失败 */
+#define COMGR_SHARED_STACK  0x1U
+/* lwt内存池(含独立栈)使用大页，减少大量栈带来的TLB缺失 */
+#define COMGR_HUGEPAGE      0x2U
+
+typedef uint64_t coscope_t[COSCOPE_SIZE];
+typedef uint64_t cojob_t[COJOB_SIZE];
+
 int cosem_special   (void);
 int cosem_init  (void *sem);
 int cosem_fini  (void *sem);
@@ -23,20 +38,70 @@ int cosem_up    (void *sem);
 int cosem_down  (void *sem);
 void    cosem_sleep (uint32_t ms);
 
+/* 超时返回ETIMEDOUT，与其他cosem接口一起通过sema_register注册 */
+int cosem_timeddown (void *sem, uint32_t ms);
+
+/* 等待多个属于当前lwt的cosem，all为false时返回第一个就绪的下标，
+ * all为true时全部就绪后返回0；ms为0表示不超时，超时返回COSEL_TIMEOUT */
+int co_select   (void   **sems,
+                uint32_t    n,
+                bool    all,
+                uint32_t    ms);
+
 int coroutine_run   (comgr_t    *mgr,
                     void    *args,
                     coroutine_func func,
                     coroutine_func fini);
 
+int coroutine_run_batch (comgr_t    *mgr,
+                        uint32_t    n,
+                        void    **args,
+                        coroutine_func func,
+                        coroutine_func fini);
+
 void    coroutine_yield (void);
+void    coroutine_maybe_yield   (void);
+
+/* scope归属于调用co_scope_init的lwt，只能由该lwt执行co_spawn/co_join */
+int co_scope_init   (coscope_t  scope);
+int co_scope_fini   (coscope_t  scope);
+int co_spawn    (coscope_t  scope,
+                void    *args,
+                coroutine_func func);
+int co_join (coscope_t  scope);
+
+/* 在线程池中执行可能阻塞的func，当前lwt挂起直到func返回，worker继续调度其他lwt */
+int co_offload  (threadpool_t   *pool,
+                work_func   func,
+                void    *args);
+
+/* 在worker线程上直接执行func(不创建lwt，不能调用cosem等lwt接口)，ms为0表示立即执行；
+ * job由调用者提供，func开始执行前不能释放，comgr_destroy时未执行的job直接丢弃 */
+int comgr_post  (comgr_t    *mgr,
+                cojob_t job,
+                uint32_t    ms,
+                coroutine_func func,
+                void    *args);
 
 comgr_t *comgr_create   (const char *name,
                         uint32_t    max_lwt,
                         uint32_t    max_worker,
                         uint32_t    stack_size);
 
+comgr_t *comgr_create_ex    (const char *name,
+                            uint32_t    max_lwt,
+                            uint32_t    max_worker,
+                            uint32_t    stack_size,
+                            uint32_t    flags);
+
 void    comgr_destroy   (comgr_t    *mgr);
 
+/* slice: 时间片(毫秒)，coroutine_maybe_yield在用完后让出；
+ * watchdog: 超过该时长未切换的lwt记入costat；均为0表示关闭 */
+void    comgr_setslice  (comgr_t    *mgr,
+                        uint32_t    slice,
+                        uint32_t    watchdog);
+
 #ifdef __cplusplus
 }
 #endif
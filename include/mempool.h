@@ -5,7 +5,10 @@
 #ifndef __MEMPOOL_H__
 #define __MEMPOOL_H__
 
+#include "sysdef.h"
+
 #include <stdint.h>
+#include <stdbool.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -16,23 +19,87 @@ extern "C" {
 
 typedef struct memorypool mempool_t;
 
+/* 每个线程缓存少量空闲单元，批量与位图交换以减少位图锁竞争；缓存容量按单元数
+ * 限制，单元过少时不启用；缓存中的单元对其他线程不可见 */
+#define MEMPOOL_MAGAZINE    0x1U
+/* 位图使用无锁模式，分配和释放不再持有位图锁 */
+#define MEMPOOL_LOCKFREE    0x2U
+/* 空闲链表引擎：空闲单元内嵌链表指针，无锁栈O(1)分配释放，不扫描位图；
+ * 单元至少4字节，空闲单元的前4字节会被改写 */
+#define MEMPOOL_FREELIST    0x4U
+/* 空闲链表引擎下记录每个单元的分配状态以检测重复释放(包括释放到线程缓存的单元) */
+#define MEMPOOL_DEBUG       0x8U
+/* 可增长模式：count为上限，按位图分段启用，用尽时启用下一个分段；
+ * 末尾分段空闲超过冷却时间后通过madvise归还物理页。不能与ptr或FREELIST同时使用 */
+#define MEMPOOL_GROWABLE    0x10U
+/* 大页模式：单元内存优先使用MAP_HUGETLB，失败时退化为MADV_HUGEPAGE，不能与ptr同时使用 */
+#define MEMPOOL_HUGEPAGE    0x20U
+/* 创建时逐页写入，提前完成缺页，不能与ptr同时使用 */
+#define MEMPOOL_PREFAULT    0x40U
+/* NUMA模式：按节点划分分区并mbind到对应节点，优先从调用者所在节点申请，
+ * 不足时再从其他节点申请；不能与ptr、GROWABLE或FREELIST同时使用 */
+#define MEMPOOL_NUMA        0x80U
+/* 着色模式：各位图分段的起始地址依次错开若干缓存行，使不同分段的同序号单元
+ * 落在不同的缓存组；单元跨度不足两个缓存行时无效果，不能与ptr或FREELIST同时使用 */
+#define MEMPOOL_COLOR       0x100U
+
+/* 单元对齐：跨度向上取整为n的倍数且首地址按n对齐，n为2的幂且不超过页大小，
+ * 记录在flags的高8位，不能与ptr同时使用；n为0或不是2的幂时创建失败 */
+#define MEMPOOL_ALIGN_SHIFT 24
+#define MEMPOOL_ALIGN_BAD   (0xFFU << MEMPOOL_ALIGN_SHIFT)
+#define MEMPOOL_ALIGN(n)    (((0 != (n)) && (0 == ((n) & ((n) - 1))))                  \
+                                ? ((uint32_t)__builtin_ctz(n) << MEMPOOL_ALIGN_SHIFT)   \
+                                : MEMPOOL_ALIGN_BAD)
+#define MEMPOOL_CACHEALIGN  MEMPOOL_ALIGN(CACHELINE_SIZE)
+
+/* mempool_info_t.backing：单元内存的实际来源 */
+#define MEMPOOL_BACK_HEAP       0   /* 随内存池结构malloc */
+#define MEMPOOL_BACK_USER       1   /* 调用者传入 */
+#define MEMPOOL_BACK_MMAP       2   /* 普通页映射 */
+#define MEMPOOL_BACK_THP        3   /* 透明大页 */
+#define MEMPOOL_BACK_HUGETLB    4   /* hugetlbfs大页 */
+
 /*************************************************************************
 *************************************************************************/
 
 mempool_t *mempool_create(uint32_t size, uint32_t count, void *ptr);
+mempool_t *mempool_create_ex(uint32_t size, uint32_t count, void *ptr, uint32_t flags);
 void mempool_destroy(mempool_t *pool);
 
+/* 耗尽时等待其他单元释放(lwt中挂起协程)，最多等待约1秒后返回NULL */
 void *mempool_alloc(mempool_t *pool);
+/* 耗尽时立即返回NULL，不会睡眠 */
+void *mempool_try_alloc(mempool_t *pool);
 void mempool_free(mempool_t *pool, void *mem);
 
+/* 批量申请最多n个单元写入out，不等待，返回实际申请的个数；
+ * 每个位图一次加锁并尽量整字占用，不经过线程缓存 */
+uint32_t mempool_alloc_bulk(mempool_t *pool, uint32_t n, void **out);
+/* 批量释放，连续属于同一位图的单元一次加锁释放 */
+void mempool_free_bulk(mempool_t *pool, uint32_t n, void **ptrs);
+
+/* 判断mem是否属于pool的内存空间 */
+bool mempool_owned(mempool_t *pool, const void *mem);
+
+/* 可增长模式下归还空闲超过冷却时间的末尾分段，释放路径也会顺带检查 */
+void mempool_trim(mempool_t *pool);
+
+/* 所有内存池创建时以"mp@地址"登记到mpstat命令，可改为便于识别的名称(截断为31字节)，
+ * 名称重复时后设置的不会出现在mpstat中 */
+void mempool_setname(mempool_t *pool, const char *name);
+
 /*************************************************************************
 *************************************************************************/
 
 typedef struct
 {
-    uint32_t    fix_size;       /* 内存分片大小 */
+    uint32_t    fix_size;       /* 内存分片大小(对齐后的跨度) */
     uint32_t    total;          /* 总数 */
     uint32_t    used;           /* 已用数量 */
+    uint32_t    cached;         /* 线程缓存中的空闲数量 */
+    uint32_t    active;         /* 已启用的数量(可增长模式) */
+    uint32_t    backing;        /* MEMPOOL_BACK_xxx */
+    uint32_t    nodes;          /* NUMA分区数 */
 }mempool_info_t;
 
 void mempool_getinfo(mempool_t *pool, mempool_info_t *info);
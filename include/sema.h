@@ -21,12 +21,14 @@ typedef uint64_t sema_t[SEM_SIZE];
 /*************************************************************************
 *************************************************************************/
 
+/* timeddown可选(可为NULL)，超时返回ETIMEDOUT，未注册时sema_timeddown退化为一直等待 */
 int sema_register(int   (*special)(void),
                     int (*init)(void *sem),
                     int (*fini)(void *sem),
                     int (*up)(void *sem),
                     int (*down)(void *sem),
-                    void    (*sleep)(uint32_t ms));
+                    void    (*sleep)(uint32_t ms),
+                    int (*timeddown)(void *sem, uint32_t ms));
 
 /*************************************************************************
 *************************************************************************/
@@ -36,8 +38,14 @@ void    sema_fini   (sema_t sem);
 void    sema_down   (sema_t sem);
 void    sema_up (sema_t sem);
 
+/* 最多等待ms毫秒，成功返回0，超时返回ETIMEDOUT(超时后到达的up仍需down消耗) */
+int     sema_timeddown  (sema_t sem, uint32_t ms);
+
 void    sema_msleep (sema_t sem, uint32_t ms);
 
+/* 取出当前线程sema_down/sema_msleep的调用点并清零，供注册的down/sleep统计阻塞点 */
+uintptr_t   sema_waitsite   (void);
+
 /*************************************************************************
 *************************************************************************/
 
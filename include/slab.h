@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Created by Hongbo Li <lihb2113@outlook.com>
+ */
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*************************************************************************
+*************************************************************************/
+
+/*
+ * 多规格内存分配器：8B~4KB按规格分桶，每个规格由若干mempool组成，按需倍增扩展；
+ * 每个线程对每个规格缓存少量空闲单元。超过SLAB_MAX_SIZE的申请直接使用malloc。
+ * 释放时需传入申请时的size(或同一规格内的任意size)。
+ */
+#define SLAB_MAX_SIZE   4096U
+
+typedef struct slab slab_t;
+
+/*************************************************************************
+*************************************************************************/
+
+/* count为每个规格首个mempool的单元数，之后每次扩展数量翻倍 */
+slab_t  *slab_create    (uint32_t count);
+void    slab_destroy    (slab_t *slab);
+
+void    *slab_alloc (slab_t *slab, size_t size);
+void    slab_free   (slab_t *slab, void *mem, size_t size);
+
+/* size所在规格的实际大小，超过SLAB_MAX_SIZE时返回size */
+size_t  slab_usable (size_t size);
+
+/*************************************************************************
+*************************************************************************/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
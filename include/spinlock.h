@@ -5,6 +5,8 @@
 #ifndef __SPINLOCK_H__
 #define __SPINLOCK_H__
 
+#include <stdbool.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -49,6 +51,12 @@ static inline void spinlock_lock(spinlock_t *lock)
                         : "memory");
 }
 
+/* 只尝试一次，成功返回true */
+static inline bool spinlock_trylock(spinlock_t *lock)
+{
+    return (0 == __atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE));
+}
+
 static inline void spinlock_unlock(spinlock_t *lock)
 {
     long unlock_val = 0;
@@ -98,6 +106,11 @@ static inline void spinlock_lock(spinlock_t *lock)
     }
 }
 
+static inline bool spinlock_trylock(spinlock_t *lock)
+{
+    return (0 == pthread_spin_trylock(lock));
+}
+
 static inline void spinlock_unlock(spinlock_t *lock)
 {
     int ret = pthread_spin_unlock(lock);
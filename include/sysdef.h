@@ -12,6 +12,9 @@
 
 #define UNREFERENCE(x)      ((void)x)
 
+#define CACHELINE_SIZE      64
+#define __cacheline_aligned __attribute__((aligned(CACHELINE_SIZE)))
+
 #define likely(x)       __builtin_expect(!!(x), 1)
 #define unlikely(x)     __builtin_expect(!!(x), 0)
 
@@ -0,0 +1,279 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Created by Hongbo Li <lihb2113@outlook.com>
+ */
+#include "arena.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+
+/*************************************************************************
+*************************************************************************/
+
+#define ARENA_CHUNKS    4096U   /* 内部块池的块数，可增长模式下按需占用物理内存 */
+#define ARENA_ROUND(n)  (((n) + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1))
+
+typedef struct _arena_chunk _chunk_t;
+typedef struct _arena_large _large_t;
+
+/* 块头，块依次链接到首块 */
+struct _arena_chunk
+{
+    _chunk_t        *prev;
+    char            *end;
+    bool            heap;           /* 块来自malloc */
+};
+
+/* 大块头 */
+struct _arena_large
+{
+    _large_t        *prev;
+};
+
+#define CHUNK_HDR   ARENA_ROUND(sizeof(_chunk_t))
+#define LARGE_HDR   ARENA_ROUND(sizeof(_large_t))
+
+/* arena结构位于首块的块头之后 */
+struct arena
+{
+    mempool_t       *pool;
+    size_t          size;           /* 块大小 */
+    char            *base;          /* 首块中的分配起点 */
+
+    _chunk_t        *chunk;         /* 当前块 */
+    char            *ptr;           /* 当前块的空闲起点 */
+    _large_t        *large;         /* 最近的大块 */
+};
+
+static mempool_t *g_arena_pool = NULL;
+static pthread_once_t g_arena_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_arena_key;
+
+/*************************************************************************
+*************************************************************************/
+
+static void _arena_exit(void *args)
+{
+    arena_destroy((arena_t *)args);
+}
+
+/* 内部块池只创建一次，进程退出前不销毁；创建失败时块全部来自malloc */
+static void _arena_init(void)
+{
+    g_arena_pool = mempool_create_ex(ARENA_CHUNK_SIZE, ARENA_CHUNKS, NULL, MEMPOOL_GROWABLE);
+    if (NULL == g_arena_pool)
+    {
+        log_warn("arena: create chunk pool failed, fallback to malloc");
+    }
+    else
+    {
+        mempool_setname(g_arena_pool, "arena");
+    }
+
+    if (0 != pthread_key_create(&g_arena_key, _arena_exit))
+    {
+        log_error("arena: create thread key failed");
+        abort();
+    }
+}
+
+static _chunk_t *_chunk_new(mempool_t *pool, size_t size)
+{
+    _chunk_t *chunk = (NULL != pool) ? (_chunk_t *)mempool_try_alloc(pool) : NULL;
+    bool heap = (NULL == chunk);
+    if (heap)
+    {
+        chunk = (_chunk_t *)malloc(size);
+        if (NULL == chunk)
+        {
+            log_error("arena: malloc chunk failed");
+            return NULL;
+        }
+    }
+
+    chunk->prev = NULL;
+    chunk->end = (char *)chunk + size;
+    chunk->heap = heap;
+    return chunk;
+}
+
+static void _chunk_free(mempool_t *pool, _chunk_t *chunk)
+{
+    if (chunk->heap)
+    {
+        free(chunk);
+        return;
+    }
+
+    mempool_free(pool, chunk);
+}
+
+static void *_arena_alloc_slow(arena_t *arena, size_t size)
+{
+    /* 1. 超过块容量时单独申请 */
+    if (size > arena->size - CHUNK_HDR)
+    {
+        _large_t *large = (_large_t *)malloc(LARGE_HDR + size);
+        if (NULL == large)
+        {
+            log_error("arena: malloc %zu failed", size);
+            return NULL;
+        }
+
+        large->prev = arena->large;
+        arena->large = large;
+        return (char *)large + LARGE_HDR;
+    }
+
+    /* 2. 当前块剩余空间不足，换新块，剩余部分在回退前不再使用 */
+    _chunk_t *chunk = _chunk_new(arena->pool, arena->size);
+    if (NULL == chunk)
+    {
+        return NULL;
+    }
+
+    chunk->prev = arena->chunk;
+    arena->chunk = chunk;
+    arena->ptr = (char *)chunk + CHUNK_HDR + size;
+    return (char *)chunk + CHUNK_HDR;
+}
+
+/*************************************************************************
+*************************************************************************/
+
+arena_t *arena_create(mempool_t *pool)
+{
+    if (NULL == pool)
+    {
+        (void)pthread_once(&g_arena_once, _arena_init);
+        pool = g_arena_pool;
+    }
+
+    mempool_info_t info = {0};
+    size_t size = ARENA_CHUNK_SIZE;
+    if (NULL != pool)
+    {
+        mempool_getinfo(pool, &info);
+        size = info.fix_size;
+    }
+
+    if (size < CHUNK_HDR + ARENA_ROUND(sizeof(arena_t)) + ARENA_ALIGN)
+    {
+        log_error("arena: chunk size %zu too small", size);
+        return NULL;
+    }
+
+    _chunk_t *chunk = _chunk_new(pool, size);
+    if (NULL == chunk)
+    {
+        return NULL;
+    }
+
+    if (0 != ((uintptr_t)chunk & (ARENA_ALIGN - 1)))
+    {
+        log_error("arena: chunk %p not aligned, create pool with MEMPOOL_ALIGN", (void *)chunk);
+        _chunk_free(pool, chunk);
+        return NULL;
+    }
+
+    arena_t *arena = (arena_t *)(void *)((char *)chunk + CHUNK_HDR);
+    arena->pool = pool;
+    arena->size = size;
+    arena->base = (char *)arena + ARENA_ROUND(sizeof(arena_t));
+    arena->chunk = chunk;
+    arena->ptr = arena->base;
+    arena->large = NULL;
+    return arena;
+}
+
+void arena_destroy(arena_t *arena)
+{
+    if (NULL == arena)
+    {
+        return;
+    }
+
+    /* arena结构位于首块中，最后释放 */
+    arena_reset(arena);
+    _chunk_free(arena->pool, arena->chunk);
+}
+
+void *arena_alloc(arena_t *arena, size_t size)
+{
+    if (size > SIZE_MAX - ARENA_ALIGN - LARGE_HDR)
+    {
+        return NULL;
+    }
+
+    size = ARENA_ROUND(size);
+    if (size <= (size_t)(arena->chunk->end - arena->ptr))
+    {
+        void *mem = arena->ptr;
+        arena->ptr += size;
+        return mem;
+    }
+
+    return _arena_alloc_slow(arena, size);
+}
+
+void arena_mark(arena_t *arena, arena_mark_t *mark)
+{
+    mark->chunk = arena->chunk;
+    mark->ptr = arena->ptr;
+    mark->large = arena->large;
+}
+
+void arena_rewind(arena_t *arena, const arena_mark_t *mark)
+{
+    while (arena->large != (_large_t *)mark->large)
+    {
+        _large_t *large = arena->large;
+        arena->large = large->prev;
+        free(large);
+    }
+
+    while (arena->chunk != (_chunk_t *)mark->chunk)
+    {
+        _chunk_t *chunk = arena->chunk;
+        arena->chunk = chunk->prev;
+        _chunk_free(arena->pool, chunk);
+    }
+
+    arena->ptr = mark->ptr;
+}
+
+void arena_reset(arena_t *arena)
+{
+    arena_mark_t mark = {
+        .chunk = (char *)arena - CHUNK_HDR,
+        .ptr = arena->base,
+        .large = NULL
+    };
+
+    arena_rewind(arena, &mark);
+}
+
+/*************************************************************************
+*************************************************************************/
+
+arena_t *arena_thread(void)
+{
+    (void)pthread_once(&g_arena_once, _arena_init);
+
+    arena_t *arena = (arena_t *)pthread_getspecific(g_arena_key);
+    if (NULL != arena)
+    {
+        return arena;
+    }
+
+    arena = arena_create(NULL);
+    if ((NULL != arena) && (0 != pthread_setspecific(g_arena_key, arena)))
+    {
+        log_error("arena: set thread arena failed");
+        arena_destroy(arena);
+        return NULL;
+    }
+
+    return arena;
+}
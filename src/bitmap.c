@@ -11,6 +11,7 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <stdbool.h>
 
 #define BMAP_MAX_LEVEL      (6)
 #define BMAP_SLICE_BITS (RECOMMEND_BITS)
@@ -32,6 +33,8 @@ typedef struct
 struct bitmap
 {
     spinlock_t      lock;
+    uint32_t        flags;              /* BITMAP_xxx */
+    uint64_t        contended;          /* 加锁竞争次数，无锁模式下为抢占失败次数 */
 
     int             max;                /* 位总数 */
     int             level;              /* 位图的层次 */
@@ -41,6 +44,16 @@ struct bitmap
 /*************************************************************************
 *************************************************************************/
 
+/* 先尝试一次，失败时记录竞争再自旋 */
+static inline void _bitmap_lock(bitmap_t *bmap)
+{
+    if (!spinlock_trylock(&bmap->lock))
+    {
+        (void)__atomic_fetch_add(&bmap->contended, 1, __ATOMIC_RELAXED);
+        spinlock_lock(&bmap->lock);
+    }
+}
+
 static inline int _div_upward_round(int num, int base)
 {
     return (num + base -1) / base;
@@ -64,7 +77,8 @@ static inline int _find_first_zero_bit(_bits_t *bits, int *pos)
     int64_t res = 0;
     for (int i = 0; i < array_size; i++)
     {
-        uint64_t bmap = ~(bits->area[i]);
+        /* 无锁模式下可能被并发修改，读取单个字即可 */
+        uint64_t bmap = ~__atomic_load_n(&bits->area[i], __ATOMIC_RELAXED);
 
         res = bmap_bsf(bmap);
         if (res >= 0)
@@ -172,10 +186,227 @@ static int _bitmap_clear_bit(bitmap_t *bmap, int pos)
     return BIT_OK;
 }
 
+/* 从空闲掩码free中取最低的最多n个有效位，base为该字第一个位的序号 */
+static inline uint64_t _word_take(bitmap_t *bmap, int base, uint64_t free, int n)
+{
+    int valid = bmap->max - base;
+    if (valid < BMAP_U64_BITS)
+    {
+        free &= (1UL << valid) - 1;
+    }
+
+    uint64_t want = 0;
+    for (int i = 0; (i < n) && (0 != free); i++)
+    {
+        uint64_t low = free & (~free + 1);
+        want |= low;
+        free &= ~low;
+    }
+
+    return want;
+}
+
+/* 将掩码中的位转换为位序号写入bits，返回个数 */
+static inline int _word_bits(uint64_t mask, int base, int *bits)
+{
+    int count = 0;
+    while (0 != mask)
+    {
+        bits[count++] = base + (int)bmap_bsf(mask);
+        mask &= mask - 1;
+    }
+
+    return count;
+}
+
+/* 底层位已设置，slice占满时逐层向上设置 */
+static void _bitmap_fill_up(bitmap_t *bmap, int pos)
+{
+    int bit = pos;
+    for (int i = bmap->level - 1; i > 0; i--)
+    {
+        int count = _get_slice_bit_count(&(bmap->layer[i]), bit);
+        int slice = bit / BMAP_SLICE_BITS;
+        _bits_t check = {.count = count,
+                            .area = bmap->layer[i].area + slice * BMAP_SLICE_U64};
+        if (BIT_OK == _find_first_zero_bit(&check, NULL))
+        {
+            break;
+        }
+
+        if (BIT_OK != _set_bit(&(bmap->layer[i - 1]), slice))
+        {
+            break;
+        }
+
+        bit = slice;
+    }
+}
+
+/* 加锁后的查找，与bitmap_allocbit的下降过程相同 */
+static int _bitmap_find(bitmap_t *bmap, int *bit)
+{
+    int pos = 0;
+    int ret = _find_first_zero_bit(&bmap->layer[0], &pos);
+    if (BIT_OK != ret)
+    {
+        return ret;
+    }
+
+    int start = 0;
+    for (int i = 1; i < bmap->level; i++)
+    {
+        start += pos;
+        start *= BMAP_SLICE_BITS;
+
+        int count = _get_slice_bit_count(&(bmap->layer[i]), start);
+        _bits_t bits = {.count = count,
+                            .area = bmap->layer[i].area + start / BMAP_U64_BITS};
+        ret = _find_first_zero_bit(&bits, &pos);
+        assert(ret == BIT_OK);
+    }
+
+    *bit = start + pos;
+    return BIT_OK;
+}
+
 /*************************************************************************
 *************************************************************************/
 
-bitmap_t *bitmap_create(int bit_count)
+/*
+ * 无锁模式：最底层位图是唯一可信的分配状态，通过原子fetch-or/fetch-and占用和释放；
+ * 上层位只是"slice已满"的提示，延迟维护。提示过时只会多扫描一次slice，不会导致重复分配：
+ * - 置满提示后再检查一次slice，期间有释放则撤销，避免有空闲位却被标记为满；
+ * - 释放时先清底层位再清各层提示。
+ */
+
+static inline bool _slice_full(_bits_t *bits, int pos)
+{
+    int slice = pos / BMAP_SLICE_BITS;
+    _bits_t check = {.count = _get_slice_bit_count(bits, pos),
+                        .area = bits->area + slice * BMAP_SLICE_U64};
+
+    return (BIT_OK != _find_first_zero_bit(&check, NULL));
+}
+
+/* pos为第level层的位，沿该位所在slice向上补充已满提示 */
+static void _lockfree_mark_full(bitmap_t *bmap, int level, int pos)
+{
+    int bit = pos;
+    for (int i = level; i > 0; i--)
+    {
+        if (!_slice_full(&bmap->layer[i], bit))
+        {
+            break;
+        }
+
+        int slice = bit / BMAP_SLICE_BITS;
+        uint64_t mask = 1UL << (slice & BMAP_U64_MASK);
+        uint64_t *word = &bmap->layer[i - 1].area[slice / BMAP_U64_BITS];
+        (void)__atomic_fetch_or(word, mask, __ATOMIC_SEQ_CST);
+
+        if (!_slice_full(&bmap->layer[i], bit))
+        {
+            (void)__atomic_fetch_and(word, ~mask, __ATOMIC_SEQ_CST);
+            break;
+        }
+
+        bit = slice;
+    }
+}
+
+/* 按提示逐层下降找到一个空闲的底层位，slice实际已满时补上提示后重新开始 */
+static int _lockfree_find(bitmap_t *bmap, int *bit)
+{
+    int last = bmap->level - 1;
+
+retry:
+    ;
+    int pos = 0;
+    if (BIT_OK != _find_first_zero_bit(&bmap->layer[0], &pos))
+    {
+        return BIT_FAIL;
+    }
+
+    int start = 0;
+    for (int i = 1; i <= last; i++)
+    {
+        start += pos;
+        start *= BMAP_SLICE_BITS;
+
+        _bits_t bits = {.count = _get_slice_bit_count(&(bmap->layer[i]), start),
+                            .area = bmap->layer[i].area + start / BMAP_U64_BITS};
+        if (BIT_OK != _find_first_zero_bit(&bits, &pos))
+        {
+            _lockfree_mark_full(bmap, i, start);
+            goto retry;
+        }
+    }
+
+    *bit = start + pos;
+    return BIT_OK;
+}
+
+/* 在空闲位所在的字上一次原子占用最多n个空闲位，竞争失败则重新查找 */
+static int _lockfree_allocbits(bitmap_t *bmap, int *bits, int n)
+{
+    int last = bmap->level - 1;
+    int got = 0;
+    int target = 0;
+    while ((got < n) && (BIT_OK == _lockfree_find(bmap, &target)))
+    {
+        int base = target & ~BMAP_U64_MASK;
+        uint64_t *word = &bmap->layer[last].area[target / BMAP_U64_BITS];
+        uint64_t want = _word_take(bmap, base, ~__atomic_load_n(word, __ATOMIC_RELAXED), n - got);
+        uint64_t taken = want & ~__atomic_fetch_or(word, want, __ATOMIC_SEQ_CST);
+        if (0 == taken)
+        {
+            (void)__atomic_fetch_add(&bmap->contended, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        got += _word_bits(taken, base, bits + got);
+        _lockfree_mark_full(bmap, last, target);
+    }
+
+    return got;
+}
+
+static inline int _lockfree_allocbit(bitmap_t *bmap, int *bit)
+{
+    return (1 == _lockfree_allocbits(bmap, bit, 1)) ? BIT_OK : BIT_FAIL;
+}
+
+static int _lockfree_freebit(bitmap_t *bmap, int pos)
+{
+    int last = bmap->level - 1;
+    uint64_t mask = 1UL << (pos & BMAP_U64_MASK);
+    uint64_t old = __atomic_fetch_and(&bmap->layer[last].area[pos / BMAP_U64_BITS],
+                                        ~mask, __ATOMIC_SEQ_CST);
+    if (0 == (old & mask))
+    {
+        return BIT_FAIL;
+    }
+
+    /* 提示位可能不连续，逐层检查并清除 */
+    int bit = pos / BMAP_SLICE_BITS;
+    for (int i = last - 1; i >= 0; i--, bit /= BMAP_SLICE_BITS)
+    {
+        mask = 1UL << (bit & BMAP_U64_MASK);
+        uint64_t *word = &bmap->layer[i].area[bit / BMAP_U64_BITS];
+        if (__atomic_load_n(word, __ATOMIC_SEQ_CST) & mask)
+        {
+            (void)__atomic_fetch_and(word, ~mask, __ATOMIC_SEQ_CST);
+        }
+    }
+
+    return BIT_OK;
+}
+
+/*************************************************************************
+*************************************************************************/
+
+bitmap_t *bitmap_create_ex(int bit_count, uint32_t flags)
 {
     if (__builtin_expect(!!(bit_count <= 0), 0))
     {
@@ -210,6 +441,7 @@ bitmap_t *bitmap_create(int bit_count)
     uint64_t *area = (uint64_t *)(mem + sizeof(bitmap_t));
 
     spinlock_init(&bmap->lock);
+    bmap->flags = flags;
     bmap->max = bit_count;
     bmap->level = level;
     bits = bit_count;
@@ -225,6 +457,11 @@ bitmap_t *bitmap_create(int bit_count)
     return bmap;
 }
 
+bitmap_t *bitmap_create(int bit_count)
+{
+    return bitmap_create_ex(bit_count, 0);
+}
+
 void bitmap_destroy(bitmap_t *bmap)
 {
     if (NULL == bmap)
@@ -238,7 +475,12 @@ void bitmap_destroy(bitmap_t *bmap)
 
 int bitmap_allocbit(bitmap_t *bmap, int *bit)
 {
-    spinlock_lock(&bmap->lock);
+    if (bmap->flags & BITMAP_LOCKFREE)
+    {
+        return _lockfree_allocbit(bmap, bit);
+    }
+
+    _bitmap_lock(bmap);
 
     /* 先判断最高层 */
     int pos = 0;
@@ -281,9 +523,91 @@ int bitmap_freebit(bitmap_t *bmap, int bit)
         return BIT_FAIL;
     }
 
-    spinlock_lock(&bmap->lock);
+    if (bmap->flags & BITMAP_LOCKFREE)
+    {
+        return _lockfree_freebit(bmap, bit);
+    }
+
+    _bitmap_lock(bmap);
     int ret = _bitmap_clear_bit(bmap, bit);
     spinlock_unlock(&bmap->lock);
 
     return ret;
 }
+
+int bitmap_allocbits(bitmap_t *bmap, int *bits, int n)
+{
+    if (bmap->flags & BITMAP_LOCKFREE)
+    {
+        return _lockfree_allocbits(bmap, bits, n);
+    }
+
+    /* 整字占用，每个字只做一次向上更新 */
+    int last = bmap->level - 1;
+    int got = 0;
+    int target = 0;
+    _bitmap_lock(bmap);
+    while ((got < n) && (BIT_OK == _bitmap_find(bmap, &target)))
+    {
+        int base = target & ~BMAP_U64_MASK;
+        uint64_t *word = &bmap->layer[last].area[target / BMAP_U64_BITS];
+        uint64_t want = _word_take(bmap, base, ~(*word), n - got);
+
+        *word |= want;
+        got += _word_bits(want, base, bits + got);
+        _bitmap_fill_up(bmap, target);
+    }
+    spinlock_unlock(&bmap->lock);
+
+    return got;
+}
+
+int bitmap_freebits(bitmap_t *bmap, const int *bits, int n)
+{
+    int ret = BIT_OK;
+    if (bmap->flags & BITMAP_LOCKFREE)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            if ((bits[i] >= bmap->max) || (BIT_OK != _lockfree_freebit(bmap, bits[i])))
+            {
+                ret = BIT_FAIL;
+            }
+        }
+
+        return ret;
+    }
+
+    _bitmap_lock(bmap);
+    for (int i = 0; i < n; i++)
+    {
+        if ((bits[i] >= bmap->max) || (BIT_OK != _bitmap_clear_bit(bmap, bits[i])))
+        {
+            ret = BIT_FAIL;
+        }
+    }
+    spinlock_unlock(&bmap->lock);
+
+    return ret;
+}
+
+/* 只读取底层位，并发修改时为近似值 */
+void bitmap_getinfo(bitmap_t *bmap, bitmap_info_t *info)
+{
+    _bits_t *bits = &bmap->layer[bmap->level - 1];
+    int array_size = _div_upward_round(bits->count, BMAP_U64_BITS);
+
+    info->total = bmap->max;
+    info->used = 0;
+    for (int i = 0; i < array_size; i++)
+    {
+        info->used += __builtin_popcountl(__atomic_load_n(&bits->area[i], __ATOMIC_RELAXED));
+    }
+
+    info->contended = __atomic_load_n(&bmap->contended, __ATOMIC_RELAXED);
+}
+
+void bitmap_resetinfo(bitmap_t *bmap)
+{
+    __atomic_store_n(&bmap->contended, 0, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,116 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Created by Hongbo Li <lihb2113@outlook.com>
+ */
+#include "coawait.h"
+
+#include "log.h"
+
+#include <exception>
+
+namespace co {
+
+/*************************************************************************
+*************************************************************************/
+
+static void _resume(void *args)
+{
+    std::coroutine_handle<>::from_address(args).resume();
+}
+
+int waiter::resume(uint32_t ms)
+{
+    return comgr_post(mgr, job, ms, _resume, handle.address());
+}
+
+void waitlist::push(waiter *w)
+{
+    w->next = nullptr;
+    if (nullptr == tail_)
+    {
+        head_ = w;
+    }
+    else
+    {
+        tail_->next = w;
+    }
+
+    tail_ = w;
+}
+
+waiter *waitlist::pop()
+{
+    waiter *w = head_;
+    head_ = w->next;
+    if (nullptr == head_)
+    {
+        tail_ = nullptr;
+    }
+
+    return w;
+}
+
+/*************************************************************************
+*************************************************************************/
+
+void task::promise_type::unhandled_exception() noexcept
+{
+    /* 分离运行的协程没有接收异常的地方 */
+    log_error("unhandled exception in coroutine task");
+    std::terminate();
+}
+
+int spawn(comgr_t *mgr, task &&t)
+{
+    task::handle_type handle = t.handle_;
+    task::promise_type &promise = handle.promise();
+    promise.mgr = mgr;
+    promise.start.mgr = mgr;
+    promise.start.handle = handle;
+    if (0 != promise.start.resume())
+    {
+        return -1;
+    }
+
+    /* 协程帧此后由自身在结束时释放 */
+    t.handle_ = nullptr;
+    return 0;
+}
+
+/*************************************************************************
+*************************************************************************/
+
+void semaphore::up()
+{
+    std::unique_lock<std::mutex> guard(lock_);
+    if (waiters_.empty())
+    {
+        val_++;
+        return;
+    }
+
+    waiter *w = waiters_.pop();
+    guard.unlock();
+    (void)w->resume();
+}
+
+bool semaphore::awaiter::await_suspend(task::handle_type handle)
+{
+    std::lock_guard<std::mutex> guard(sem_.lock_);
+    if (0 < sem_.val_)
+    {
+        sem_.val_--;
+        return false;
+    }
+
+    /* 解锁后可能立即被其他线程恢复，不能再访问自身 */
+    waiter_.mgr = handle.promise().mgr;
+    waiter_.handle = handle;
+    sem_.waiters_.push(&waiter_);
+    return true;
+}
+
+/*************************************************************************
+*************************************************************************/
+
+} // namespace co
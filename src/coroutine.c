@@ -3,6 +3,7 @@
  * Created by Hongbo Li <lihb2113@outlook.com>
  */
 #include "costat.h"
+#include "arena.h"
 #include "threadpool.h"
 #include "spinlock.h"
 #include "atomic.h"
@@ -20,6 +21,8 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <time.h>
+#include <sched.h>
+#include <pthread.h>
 #include <sys/types.h>
 
 /*************************************************************************
@@ -28,12 +31,34 @@
 #define CLEN_MAX        256
 #define MIN_LWT         16
 #define MIN_WORKER      1
+#define LWT_CACHE       32      /* 每个worker缓存的lwt上限 */
+#define RUNNEXT_MAX     64      /* runnext连续调度上限，避免饿死队列中的lwt */
+
+#define CALIBRATE_US    10000
+
+#define STACK_POISON    0x5aa5c33c5aa5c33cUL   /* 栈水位采样的填充值 */
+#define STACK_MIN_BITS  8                       /* 直方图第0档为256字节 */
+#define STACK_PAGE      4096
+#define STACK_SAVE      256     /* 共享栈模式下保存缓冲区的分配粒度 */
+
+#define DEF_SLICE       10      /* 默认时间片，毫秒 */
+#define DEF_WATCHDOG    1000    /* 默认长时间运行告警门限，毫秒 */
+
+#define SELECT_BIAS     (1 << 24)   /* co_select登记时累加到val，与普通down区分 */
+#define SELECT_IDLE     (-1)
+#define SELECT_WAIT     (-2)
+#define SELECT_TIMEOUT  (-3)
+#define SELECT_CANCEL   (-4)
 
 #define LWT_BEGIN(_mgr, _op, _ts)                       \
-    _lwt_begin(&(_mgr)->info->lwt.op[_op], _ts)
+    _lwt_begin(_mgr, _op, _ts)
 
 #define LWT_END(_mgr, _op, _ts)                         \
-    _lwt_end(&(_mgr)->info->lwt.op[_op], _ts)
+    _lwt_end(_mgr, _op, _ts)
+
+/* 阻塞点：调用者的返回地址，经sema接口进入时取sema接口的调用者 */
+#define WAIT_SITE()                                     \
+    _wait_site((uintptr_t)__builtin_extract_return_addr(__builtin_return_address(0)))
 
 /*************************************************************************
 *************************************************************************/
@@ -42,19 +67,50 @@ typedef struct _worker _worker_t;
 typedef struct _sleeper _sleeper_t;
 typedef struct _lwt _lwt_t;
 
+/* 统计分片，每个worker一份(单写者)，外部线程共用最后一份(原子操作) */
+typedef struct
+{
+    lwtop_t             op[LwtEnd];
+
+    struct
+    {
+        uint64_t        count;
+        uint64_t        max;
+        uint64_t        hist[STACK_BUCKETS];
+    }stack;
+
+    coblock_t           block[BLOCK_SITES + 1];    /* 阻塞点开放寻址表，最后一项为溢出项 */
+}__cacheline_aligned _lwtstat_t;
+
 typedef struct
 {
     _lwt_t          *lwt;
     int32_t         val;
-    int             ret;
+    uint32_t        index;      /* 在co_select数组中的下标 */
     uint64_t        ts;
-    list_head_t     link;
 }_cosem_t;
 
+typedef struct
+{
+    _cosem_t        sem;        /* 父lwt等待子lwt全部结束 */
+    int32_t         pending;    /* 未结束的子lwt数 + 父lwt持有的1个引用 */
+    comgr_t         *mgr;
+}_coscope_t;
+
+typedef struct
+{
+    _cosem_t        sem;        /* 发起lwt等待线程池执行完成 */
+    work_func       func;
+    void            *args;
+}_offload_t;
+
+_Static_assert(sizeof(_coscope_t) <= sizeof(coscope_t), "coscope_t too small");
+
 struct _worker
 {
     ucontext_t          ctx;
     comgr_t             *mgr;
+    _lwtstat_t          *stat;
 
     threadraw_t         *thread;
 
@@ -64,25 +120,66 @@ struct _worker
         int32_t         count;
         int32_t         wait;
         list_head_t     head;
+        list_head_t     local;      /* 本worker内唤醒的lwt，仅worker线程访问 */
+        _lwt_t          *next;      /* 当前lwt让出后立即调度的lwt，仅worker线程访问 */
+        uint32_t        chain;      /* 连续从next调度的次数 */
     }lwt;
 
+    list_head_t         job;        /* comgr_post投递的job，受lock保护，计入lwt.wait */
+
     struct
     {
         int32_t         count;
         list_head_t     head;
     }sem;
 
+    struct
+    {
+        uint32_t        count;
+        _lwt_t          *list[LWT_CACHE];
+    }cache;                         /* 已释放lwt的LIFO缓存，仅worker线程访问 */
+
+    struct
+    {
+        void            *base;      /* 共享栈，仅共享栈模式 */
+        _lwt_t          *owner;     /* 共享栈上当前是哪个lwt的内容 */
+    }stack;
+
+    struct
+    {
+        uint64_t        seq;        /* 调度序号，每次切入lwt时递增 */
+        uint64_t        tick;       /* 切入lwt时的定时器tick */
+        uint64_t        slice;      /* 时间片开始时的tick，next调度时继承 */
+        coroutine_func  func;       /* 正在运行的lwt，NULL表示空闲 */
+        uint64_t        reported;   /* 看门狗已记录的调度序号 */
+    }run;
+
+    bool                preempt;    /* 时间片已用完 */
+    arena_t             *arena;     /* 执行fini期间，已结束lwt的arena */
+
     uint64_t            ts;
     bool                swapped;
 };
 
 struct _sleeper
 {
-    _lwt_t              *lwt;
+    _lwt_t              *lwt;       /* NULL表示comgr_post的延时job */
     uint32_t            timeout;
+    bool                select;     /* co_select的超时，唤醒前需竞争 */
     list_head_t         link;
 };
 
+typedef struct
+{
+    list_head_t     link;
+    coroutine_func  func;
+    void            *args;
+    _worker_t       *worker;
+    _sleeper_t      sleeper;    /* 延时投递 */
+}_cojob_t;
+
+_Static_assert(sizeof(_cojob_t) <= sizeof(cojob_t), "cojob_t too small");
+
 struct _lwt
 {
     list_head_t         link;
@@ -94,6 +191,38 @@ struct _lwt
 
     uint64_t            ts;
     _worker_t           *worker;
+    bool                poison;     /* 栈是否已填充，退出时测量栈水位 */
+    _coscope_t          *scope;     /* 所属的scope，结束时通知父lwt */
+    arena_t             *arena;     /* 按需创建，结束并执行fini后销毁 */
+
+    struct
+    {
+        int32_t         state;      /* SELECT_XXX或唤醒者的下标 */
+        int32_t         acks;       /* 竞争失败的up数 */
+    }select;
+
+    _sleeper_t          sleeper;    /* 定时器会访问，不能放在lwt栈上 */
+
+    struct
+    {
+        list_head_t     link;       /* 挂在worker的sem队列，cosem可能在共享栈上，不能放在cosem中 */
+        int             ret;        /* worker退出时置为-1 */
+    }blocked;
+
+    struct
+    {
+        uint64_t        ts;         /* 阻塞开始时间，0表示未统计 */
+        uint32_t        slot;       /* 在worker统计分片阻塞表中的位置 */
+        uint32_t        gen;        /* 统计清零的代数，清零前的阻塞不再统计 */
+    }block;
+
+    struct
+    {
+        bool            start;      /* 尚未在共享栈上构造上下文 */
+        uint32_t        size;
+        uint32_t        cap;
+        void            *buf;       /* 挂起时从共享栈拷贝出的内容 */
+    }save;
 };
 
 struct coroutine_mgr
@@ -101,6 +230,8 @@ struct coroutine_mgr
     char                *name;
     mempool_t           *mem;
     uint32_t            stack_size;
+    bool                shared;     /* lwt运行在worker的共享栈上 */
+    uint32_t            cache;      /* 每个worker实际缓存的lwt上限 */
 
     struct
     {
@@ -116,6 +247,34 @@ struct coroutine_mgr
         _worker_t       *list;
     }worker;
 
+    struct
+    {
+        bool            enable; /* 统计开关 */
+        uint32_t        gen;    /* 统计清零次数 */
+        _lwtstat_t      *shard; /* worker.count + 1个统计分片 */
+    }stat;
+
+    struct
+    {
+        uint32_t        sample; /* 栈水位采样间隔，0表示关闭 */
+        uint32_t        seq;    /* 采样计数 */
+    }stack;
+
+    struct
+    {
+        uint64_t        tick;       /* 定时器tick，每毫秒递增 */
+        uint32_t        slice;      /* 时间片，毫秒，0表示不抢占 */
+        uint32_t        threshold;  /* 告警门限，毫秒，0表示关闭 */
+        spinlock_t      lock;
+        uint32_t        count;
+        struct
+        {
+            coroutine_func  func;
+            uint64_t        times;
+            uint64_t        max;
+        }lwt[WATCHDOG_MAX];         /* 长时间运行的lwt记录 */
+    }watchdog;
+
     coinfo_t            *info;
 };
 
@@ -123,320 +282,1415 @@ struct coroutine_mgr
 *************************************************************************/
 
 static __thread _lwt_t *lwt_curr = NULL;
+static __thread _worker_t *worker_curr = NULL;
+
+/* 时间戳每微秒的计数，统计时延在汇总时才换算为微秒 */
+static uint64_t lwt_clock_per_us = 1000;
+static pthread_once_t lwt_clock_once = PTHREAD_ONCE_INIT;
 
 /*************************************************************************
 *************************************************************************/
 
-static inline void _lwt_begin(lwtop_t *op, uint64_t *ts)
+#ifdef _COSTAT_TSC
+
+static inline uint64_t _lwt_clock(void)
 {
-    struct timespec now = {0};
-    (void)clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
-    *ts = ((uint64_t)now.tv_sec * 1000000000UL + (uint64_t)now.tv_nsec);
+#ifdef __x86_64__
+    uint32_t low;
+    uint32_t hig;
+    __asm__ __volatile__("rdtsc" : "=a" (low), "=d" (hig));
+    return ((uint64_t)hig << 32) | low;
+#else
+    uint64_t val;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r" (val));
+    return val;
+#endif
+}
 
-    atomic_u64_inc(&op->begin);
+static void _lwt_clock_calibrate(void)
+{
+#ifdef __x86_64__
+    uint64_t ns = stimer_getnanosec();
+    uint64_t tick = _lwt_clock();
+    usleep(CALIBRATE_US);
+    ns = stimer_getnanosec() - ns;
+    tick = _lwt_clock() - tick;
+
+    uint64_t per_us = (0 == ns) ? 0 : tick * 1000 / ns;
+#else
+    uint64_t freq;
+    __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r" (freq));
+
+    uint64_t per_us = freq / 1000000;
+#endif
+    lwt_clock_per_us = (0 == per_us) ? 1 : per_us;
 }
 
-static inline void _lwt_end(lwtop_t *op, uint64_t start)
+#else
+
+static inline uint64_t _lwt_clock(void)
 {
     struct timespec now = {0};
     (void)clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
-    uint64_t end = ((uint64_t)now.tv_sec * 1000000000UL + (uint64_t)now.tv_nsec);
-    if (end < start)
+    return ((uint64_t)now.tv_sec * 1000000000UL + (uint64_t)now.tv_nsec);
+}
+
+static void _lwt_clock_calibrate(void)
+{
+    lwt_clock_per_us = 1000;
+}
+
+#endif
+
+static inline _lwtstat_t *_lwt_shard(comgr_t *mgr)
+{
+    /* 仅worker线程写自己的分片，其余线程写共享分片 */
+    if ((NULL != worker_curr) && (worker_curr->mgr == mgr))
     {
-        end = start;
+        return worker_curr->stat;
     }
 
-    atomic_u64_inc(&op->end);
+    return NULL;
+}
 
-    uint64_t cost = (end - start) / 1000;
-    atomic_u64_add(&op->delay, cost);
-    if (cost > op->max)
+static inline void _lwt_begin(comgr_t *mgr, int op, uint64_t *ts)
+{
+    /* ts为0表示未采样，对应的end不做统计 */
+    if (!atomic_bool_fetch(&mgr->stat.enable))
     {
-        op->max = cost;
+        *ts = 0;
+        return;
     }
-}
 
-/*************************************************************************
-*************************************************************************/
+    *ts = _lwt_clock();
 
-static void _timer_svc(void *args)
+    _lwtstat_t *shard = _lwt_shard(mgr);
+    if (NULL != shard)
+    {
+        shard->op[op].begin++;
+        return;
+    }
+
+    (void)atomic_u64_inc(&mgr->stat.shard[mgr->worker.count].op[op].begin);
+}
+
+static inline void _lwt_end(comgr_t *mgr, int op, uint64_t start)
 {
-    comgr_t *mgr = (comgr_t *)args;
-    spinlock_lock(&mgr->sleeper.lock);
-    do
+    if (0 == start)
     {
-        /* 1. 如果队列为空直接返回 */
-        if (list_empty(&mgr->sleeper.list))
-        {
-            break;
-        }
+        return;
+    }
 
-        /* 2. 判断队头元素是否可唤醒，如果不能唤醒则返回 */
-        _sleeper_t *sleeper = container_of(mgr->sleeper.list.next, _sleeper_t, link);
-        if (0 != sleeper->timeout)
-        {
-            sleeper->timeout--;
-        }
+    uint64_t end = _lwt_clock();
+    uint64_t cost = (end > start) ? (end - start) : 0;
 
-        if (sleeper->timeout > 0)
+    _lwtstat_t *shard = _lwt_shard(mgr);
+    if (NULL != shard)
+    {
+        lwtop_t *lop = &shard->op[op];
+        lop->end++;
+        lop->delay += cost;
+        if (cost > lop->max)
         {
-            break;
+            lop->max = cost;
         }
 
-        /* 3. 从头部开始遍历，唤醒所有能够唤醒的元素 */
-        list_head_t *curr;
-        list_head_t *next;
-        list_foreach_safe(curr, next, &mgr->sleeper.list)
-        {
-            _sleeper_t *_slp = container_of(curr, _sleeper_t, link);
-            if (0 != _slp->timeout)
-            {
-                break;
-            }
-
-            list_del(&_slp->link);
+        return;
+    }
 
-            _worker_t *worker  = _slp->lwt->worker;
-            spinlock_lock(&worker->lock);
-            LWT_BEGIN(mgr, LwtQue, &_slp->lwt->ts);
-            list_add(&_slp->lwt->link, &worker->lwt.head);
-            ++(worker->lwt.wait);
-            spinlock_unlock(&worker->lock);
-            threadraw_wakeup(worker->thread);
-        }
-    } while(0);
-    spinlock_unlock(&mgr->sleeper.lock);
-}
+    lwtop_t *lop = &mgr->stat.shard[mgr->worker.count].op[op];
+    (void)atomic_u64_inc(&lop->end);
+    (void)atomic_u64_add(&lop->delay, cost);
 
-static void _timer_cleanup(comgr_t *mgr)
-{
-    list_head_t *curr;
-    list_head_t *next;
-    list_foreach_safe(curr, next, &mgr->sleeper.list)
+    uint64_t max = atomic_u64_fetch(&lop->max);
+    while ((cost > max) && !atomic_u64_cas(&lop->max, max, cost, &max))
     {
-        _sleeper_t *_slp = container_of(curr, _sleeper_t, link);
-        list_del(&_slp->link);
-
-        _worker_t *worker = _slp->lwt->worker;
-        spinlock_lock(&worker->lock);
-        LWT_BEGIN(mgr, LwtQue, &_slp->lwt->ts);
-        list_add(&_slp->lwt->link, &worker->lwt.head);
-        ++(worker->lwt.wait);
-        spinlock_unlock(&worker->lock);
     }
 }
 
-static inline _worker_t *_choose_worker(comgr_t *mgr)
+static inline uintptr_t _wait_site(uintptr_t caller)
 {
-    uint32_t idx = ++(mgr->worker.idx);
-    return &mgr->worker.list[idx % mgr->worker.count];
+    uintptr_t site = sema_waitsite();
+    return (0 != site) ? site : caller;
 }
 
-/*************************************************************************
-*************************************************************************/
-
-static void _worker_svc(void *args)
+static inline void _block_begin(_worker_t *worker, _lwt_t *lwt, uint32_t kind, uintptr_t site)
 {
-    _worker_t *worker = (_worker_t *)args;
-
-    list_head_t lwt_head;
-    list_init(&lwt_head);
-
-    spinlock_lock(&worker->lock);
-    list_splice(&worker->lwt.head, &lwt_head);
-    worker->lwt.wait = 0;
-    spinlock_unlock(&worker->lock);
-
-    while (!list_empty(&lwt_head))
+    /* 阻塞与恢复都在lwt所属worker上执行，统计分片单写者 */
+    lwt->block.ts = 0;
+    comgr_t *mgr = worker->mgr;
+    if (!atomic_bool_fetch(&mgr->stat.enable))
     {
-        /* 取出lwt，调度执行 */
-        _lwt_t *lwt = container_of(lwt_head.next, _lwt_t, link);
-        list_del(&lwt->link);
-        LWT_END(worker->mgr, LwtQue, lwt->ts);
-
-        lwt_curr = lwt;
+        return;
+    }
 
-        worker->swapped = false;
-        LWT_BEGIN(worker->mgr, LwtRun, &worker->ts);
-        if (0 != swapcontext(&worker->ctx, &lwt->ctx))
+    coblock_t *table = worker->stat->block;
+    uint32_t slot = BLOCK_SITES;
+    uint32_t hash = (uint32_t)((site >> 2) * 2654435761UL) % BLOCK_SITES;
+    for (uint32_t i = 0; i < BLOCK_SITES; i++)
+    {
+        coblock_t *entry = &table[(hash + i) % BLOCK_SITES];
+        if (0 == entry->site)
         {
-            log_error("swapcontext fail, err(%s)", strerror(errno));
+            entry->site = site;
+            entry->kind = kind;
         }
 
-        if (worker->swapped)
+        if ((entry->site == site) && (entry->kind == kind))
         {
-            LWT_END(worker->mgr, LwtSche, worker->ts);
-            continue;
+            slot = (hash + i) % BLOCK_SITES;
+            break;
         }
+    }
 
-        LWT_END(worker->mgr, LwtRun, worker->ts);
+    table[slot].waiting++;
+    lwt->block.slot = slot;
+    lwt->block.gen = atomic_u32_fetch(&mgr->stat.gen);
+    lwt->block.ts = _lwt_clock();
+}
 
-        /* 释放lwt空间之后调用外部传入的finish方法 */
-        void *_args = lwt->args;
-        coroutine_func _fini = lwt->fini;
-        mempool_free(worker->mgr->mem, lwt);
-        if (NULL != _fini)
-        {
-            _fini(_args);
-        }
+static inline void _block_end(_worker_t *worker, _lwt_t *lwt)
+{
+    if ((0 == lwt->block.ts)
+        || (lwt->block.gen != atomic_u32_fetch(&worker->mgr->stat.gen)))
+    {
+        return;
+    }
 
-        (void)atomic_s32_dec(&worker->lwt.count);
+    uint64_t delay = _lwt_clock() - lwt->block.ts;
+    coblock_t *entry = &worker->stat->block[lwt->block.slot];
+    entry->waiting--;
+    entry->count++;
+    entry->total += delay;
+    entry->max = (delay > entry->max) ? delay : entry->max;
+}
+
+static inline bool _stack_sample(comgr_t *mgr)
+{
+    uint32_t sample = atomic_u32_fetch(&mgr->stack.sample);
+    if (0 == sample)
+    {
+        return false;
     }
 
-    lwt_curr = NULL;
+    return (0 == (atomic_u32_inc(&mgr->stack.seq) % sample)) ? true : false;
 }
 
-static void _worker_cleanup(void *args)
+static inline void _stack_poison(comgr_t *mgr, _lwt_t *lwt)
 {
-    _worker_t *worker = (_worker_t *)args;
+    uint64_t *area = (uint64_t *)(void *)(lwt + 1);
+    uint32_t count = mgr->stack_size / sizeof(uint64_t);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        area[i] = STACK_POISON;
+    }
+}
 
-    /* 1. 清空未调度的lwt */
-    spinlock_lock(&worker->lock);
-    worker->lwt.wait = 0;
-    while (!list_empty(&worker->lwt.head))
+static inline void _stack_measure(_worker_t *worker, _lwt_t *lwt)
+{
+    /* 栈向低地址增长，从栈底开始查找第一个被改写的位置 */
+    uint64_t *area = (uint64_t *)(void *)(lwt + 1);
+    uint32_t count = worker->mgr->stack_size / sizeof(uint64_t);
+    uint32_t i = 0;
+    while ((i < count) && (STACK_POISON == area[i]))
     {
-        _lwt_t *lwt = container_of(worker->lwt.head.next, _lwt_t, link);
-        list_del(&lwt->link);
-        mempool_free(worker->mgr->mem, lwt);
-        (void)atomic_s32_dec(&worker->lwt.count);
+        i++;
     }
 
-    /* 2. 唤醒所有的信号量，返回失败 */
-    while (!list_empty(&worker->sem.head))
+    uint64_t used = (uint64_t)(count - i) * sizeof(uint64_t);
+    int bucket = 0;
+    while ((bucket < STACK_BUCKETS - 1) && (used > (1UL << (STACK_MIN_BITS + bucket))))
     {
-        _cosem_t *sem = container_of(worker->sem.head.next, _cosem_t, link);
-        list_del(&sem->link);
-        --(worker->sem.count);
-        spinlock_unlock(&worker->lock);
-        sem->ret = -1;
-        if (0 != swapcontext(&worker->ctx, &sem->lwt->ctx))
-        {
-            log_error("swapcontext fail, err(%s)", strerror(errno));
-        }
+        bucket++;
+    }
 
-        spinlock_lock(&worker->lock);
+    worker->stat->stack.count++;
+    worker->stat->stack.hist[bucket]++;
+    if (used > worker->stat->stack.max)
+    {
+        worker->stat->stack.max = used;
     }
+}
 
-    spinlock_unlock(&worker->lock);
+static void _lwt_func(uint32_t low, uint32_t hig)
+{
+    uintptr_t ptr = (uintptr_t)low | ((uintptr_t)hig << 32);
+    _lwt_t *lwt = (_lwt_t *)ptr;
+
+    lwt->func(lwt->args);
 }
 
-static int _worker_need_sleep(void *args)
+static inline void _lwt_make(_lwt_t *lwt)
 {
-    _worker_t *worker = (_worker_t *)args;
-    return (0 == worker->lwt.wait) ? 1 : 0;
+    uintptr_t ptr = (uintptr_t)lwt;
+    makecontext(&lwt->ctx,
+                (void  (*)(void))_lwt_func,
+                2, (uint32_t)ptr, (uint32_t)(ptr >> 32));
 }
 
-static int _worker_init(comgr_t *mgr)
+static inline char *_lwt_sp(_lwt_t *lwt)
 {
-    mgr->worker.list = (_worker_t *)calloc(mgr->worker.count, sizeof(_worker_t));
-    if (NULL == mgr->worker.list)
+    /* 挂起时保存的栈指针，以上为需要保存的部分；其他架构保存整个栈 */
+#if defined(__x86_64__)
+    return (char *)lwt->ctx.uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__)
+    return (char *)lwt->ctx.uc_mcontext.sp;
+#else
+    return (char *)lwt->ctx.uc_stack.ss_sp;
+#endif
+}
+
+static void _stack_switch(_worker_t *worker, _lwt_t *lwt)
+{
+    _lwt_t *owner = worker->stack.owner;
+    if (owner == lwt)
     {
-        log_error("calloc fail");
-        return -1;
+        return;
     }
 
-    uint32_t i = 0;
-    for (; i < mgr->worker.count; i++)
+    /* 1. 保存占用共享栈的lwt，只拷贝实际使用的部分 */
+    char *top = (char *)worker->stack.base + worker->mgr->stack_size;
+    if (NULL != owner)
     {
-        char name[CLEN_MAX * 2] = {0};
-        sprintf_s(name, sizeof(name), "%.8s%d", mgr->name, i);
-        _worker_t *worker = &mgr->worker.list[i];
-        worker->thread = threadraw_create(name,
-                                        worker,
-                                        _worker_svc,
-                                        _worker_cleanup,
-                                        _worker_need_sleep);
-        if (NULL == worker->thread)
+        uint32_t size = (uint32_t)(top - _lwt_sp(owner));
+        if (size > owner->save.cap)
         {
-            log_error("threadraw_create fail");
-            break;
+            free(owner->save.buf);
+            owner->save.cap = (size + STACK_SAVE - 1) / STACK_SAVE * STACK_SAVE;
+            owner->save.buf = malloc(owner->save.cap);
+            sys_assert(NULL != owner->save.buf);
         }
 
-        worker->ts = 0;
-        worker->mgr = mgr;
-        worker->lwt.count = 0;
-        worker->lwt.wait = 0;
-        list_init(&worker->lwt.head);
+        (void)memcpy(owner->save.buf, top - size, size);
+        owner->save.size = size;
+    }
 
-        worker->sem.count = 0;
-        list_init(&worker->sem.head);
+    /* 2. 首次运行时在共享栈上构造上下文，否则恢复保存的内容 */
+    worker->stack.owner = lwt;
+    if (lwt->save.start)
+    {
+        lwt->save.start = false;
+        _lwt_make(lwt);
+        return;
+    }
+
+    (void)memcpy(top - lwt->save.size, lwt->save.buf, lwt->save.size);
+}
+
+static inline void _stack_release(_worker_t *worker, _lwt_t *lwt)
+{
+    if (worker->stack.owner == lwt)
+    {
+        worker->stack.owner = NULL;
+    }
+
+    free(lwt->save.buf);
+    lwt->save.buf = NULL;
+    lwt->save.cap = 0;
+}
+
+static void _watchdog_record(comgr_t *mgr,
+                            _worker_t *worker,
+                            uint64_t seq,
+                            coroutine_func func,
+                            uint64_t elapsed)
+{
+    spinlock_lock(&mgr->watchdog.lock);
+
+    /* 按函数聚合，记录满时替换最大时长最小的一项 */
+    uint32_t idx = 0;
+    uint32_t min = 0;
+    for (; idx < mgr->watchdog.count; idx++)
+    {
+        if (mgr->watchdog.lwt[idx].func == func)
+        {
+            break;
+        }
+
+        if (mgr->watchdog.lwt[idx].max < mgr->watchdog.lwt[min].max)
+        {
+            min = idx;
+        }
+    }
+
+    if (idx == mgr->watchdog.count)
+    {
+        if (idx < WATCHDOG_MAX)
+        {
+            mgr->watchdog.count++;
+        }
+        else if (elapsed > mgr->watchdog.lwt[min].max)
+        {
+            idx = min;
+        }
+        else
+        {
+            spinlock_unlock(&mgr->watchdog.lock);
+            return;
+        }
+
+        mgr->watchdog.lwt[idx].func = func;
+        mgr->watchdog.lwt[idx].times = 0;
+        mgr->watchdog.lwt[idx].max = 0;
+    }
+
+    if (worker->run.reported != seq)
+    {
+        worker->run.reported = seq;
+        mgr->watchdog.lwt[idx].times++;
+    }
+
+    if (elapsed > mgr->watchdog.lwt[idx].max)
+    {
+        mgr->watchdog.lwt[idx].max = elapsed;
+    }
+
+    spinlock_unlock(&mgr->watchdog.lock);
+}
+
+static void _watchdog_check(comgr_t *mgr)
+{
+    uint64_t tick = atomic_u64_inc(&mgr->watchdog.tick);
+    uint32_t slice = atomic_u32_fetch(&mgr->watchdog.slice);
+    uint32_t threshold = atomic_u32_fetch(&mgr->watchdog.threshold);
+
+    for (uint32_t i = 0; i < mgr->worker.count; i++)
+    {
+        /* 调度序号前后一致时，读到的func和tick属于同一次调度 */
+        _worker_t *worker = &mgr->worker.list[i];
+        uint64_t seq = atomic_u64_fetch(&worker->run.seq);
+        coroutine_func func = worker->run.func;
+        uint64_t elapsed = tick - worker->run.tick;
+        uint64_t used = tick - worker->run.slice;
+        if ((NULL == func) || (seq != atomic_u64_fetch(&worker->run.seq)))
+        {
+            continue;
+        }
+
+        if ((0 != slice) && (used >= slice))
+        {
+            atomic_bool_store(&worker->preempt, true);
+        }
+
+        if ((0 != threshold) && (elapsed >= threshold))
+        {
+            _watchdog_record(mgr, worker, seq, func, elapsed);
+        }
+    }
+}
+
+/*************************************************************************
+*************************************************************************/
+
+static void _job_queue(_cojob_t *job, bool wakeup)
+{
+    _worker_t *worker = job->worker;
+    spinlock_lock(&worker->lock);
+    list_add_tail(&job->link, &worker->job);
+    ++(worker->lwt.wait);
+    spinlock_unlock(&worker->lock);
+
+    if (wakeup)
+    {
+        threadraw_wakeup(worker->thread);
+    }
+}
+
+static void _sleeper_add(comgr_t *mgr, _sleeper_t *sleeper)
+{
+    /* 超时列表中保存的是与前一个元素的时间差 */
+    spinlock_lock(&mgr->sleeper.lock);
+    do
+    {
+        list_head_t *node;
+        list_foreach(node, &mgr->sleeper.list)
+        {
+            _sleeper_t *_slp = container_of(node, _sleeper_t, link);
+            if (_slp->timeout > sleeper->timeout)
+            {
+                _slp->timeout -= sleeper->timeout;
+                list_add(&sleeper->link, _slp->link.prev);
+                break;
+            }
+
+            sleeper->timeout -= _slp->timeout;
+        }
+
+        if (node == &mgr->sleeper.list)
+        {
+            list_add_tail(&sleeper->link, &mgr->sleeper.list);
+        }
+
+    } while(0);
+    spinlock_unlock(&mgr->sleeper.lock);
+}
+
+static void _sleeper_del(comgr_t *mgr, _sleeper_t *sleeper)
+{
+    /* 已被定时器摘除时不需处理，否则将剩余时间差归还给后一个元素 */
+    spinlock_lock(&mgr->sleeper.lock);
+    if (!list_empty(&sleeper->link))
+    {
+        if (sleeper->link.next != &mgr->sleeper.list)
+        {
+            container_of(sleeper->link.next, _sleeper_t, link)->timeout += sleeper->timeout;
+        }
+
+        list_del(&sleeper->link);
+    }
+
+    spinlock_unlock(&mgr->sleeper.lock);
+}
+
+static void _sleeper_wake(comgr_t *mgr, _sleeper_t *sleeper, bool wakeup)
+{
+    /* 延时job到期后投递到所属worker */
+    _lwt_t *lwt = sleeper->lwt;
+    if (NULL == lwt)
+    {
+        _job_queue(container_of(sleeper, _cojob_t, sleeper), wakeup);
+        return;
+    }
+
+    /* co_select的超时与up竞争，失败表明lwt已被唤醒 */
+    if (sleeper->select
+        && !atomic_s32_cas(&lwt->select.state, SELECT_WAIT, SELECT_TIMEOUT, NULL))
+    {
+        return;
+    }
+
+    _worker_t *worker = lwt->worker;
+    spinlock_lock(&worker->lock);
+    LWT_BEGIN(mgr, LwtQue, &lwt->ts);
+    list_add(&lwt->link, &worker->lwt.head);
+    ++(worker->lwt.wait);
+    spinlock_unlock(&worker->lock);
+
+    if (wakeup)
+    {
+        threadraw_wakeup(worker->thread);
+    }
+}
+
+static void _timer_svc(void *args)
+{
+    comgr_t *mgr = (comgr_t *)args;
+    _watchdog_check(mgr);
+
+    spinlock_lock(&mgr->sleeper.lock);
+    do
+    {
+        /* 1. 如果队列为空直接返回 */
+        if (list_empty(&mgr->sleeper.list))
+        {
+            break;
+        }
+
+        /* 2. 判断队头元素是否可唤醒，如果不能唤醒则返回 */
+        _sleeper_t *sleeper = container_of(mgr->sleeper.list.next, _sleeper_t, link);
+        if (0 != sleeper->timeout)
+        {
+            sleeper->timeout--;
+        }
+
+        if (sleeper->timeout > 0)
+        {
+            break;
+        }
+
+        /* 3. 从头部开始遍历，唤醒所有能够唤醒的元素 */
+        list_head_t *curr;
+        list_head_t *next;
+        list_foreach_safe(curr, next, &mgr->sleeper.list)
+        {
+            _sleeper_t *_slp = container_of(curr, _sleeper_t, link);
+            if (0 != _slp->timeout)
+            {
+                break;
+            }
+
+            list_del(&_slp->link);
+            _sleeper_wake(mgr, _slp, true);
+        }
+    } while(0);
+    spinlock_unlock(&mgr->sleeper.lock);
+}
+
+static void _timer_cleanup(comgr_t *mgr)
+{
+    list_head_t *curr;
+    list_head_t *next;
+    list_foreach_safe(curr, next, &mgr->sleeper.list)
+    {
+        _sleeper_t *_slp = container_of(curr, _sleeper_t, link);
+        list_del(&_slp->link);
+        _sleeper_wake(mgr, _slp, false);
+    }
+}
+
+static inline _lwt_t *_lwt_alloc(comgr_t *mgr, _worker_t *worker)
+{
+    /* lwt将在当前worker上运行时优先从本地缓存获取，栈空间大概率仍在cache中 */
+    if ((worker == worker_curr) && (0 != worker->cache.count))
+    {
+        return worker->cache.list[--(worker->cache.count)];
+    }
+
+    return (_lwt_t *)mempool_alloc(mgr->mem);
+}
+
+static inline void _lwt_free(comgr_t *mgr, _lwt_t *lwt)
+{
+    _worker_t *worker = worker_curr;
+    if ((NULL != worker) && (worker->mgr == mgr) && (worker->cache.count < mgr->cache))
+    {
+        worker->cache.list[(worker->cache.count)++] = lwt;
+        return;
+    }
+
+    mempool_free(mgr->mem, lwt);
+}
+
+static inline _worker_t *_choose_worker(comgr_t *mgr)
+{
+    uint32_t idx = ++(mgr->worker.idx);
+    return &mgr->worker.list[idx % mgr->worker.count];
+}
+
+/*************************************************************************
+*************************************************************************/
+
+static void _worker_svc(void *args)
+{
+    _worker_t *worker = (_worker_t *)args;
+
+    list_head_t lwt_head;
+    list_init(&lwt_head);
+
+    list_head_t job_head;
+    list_init(&job_head);
+
+    spinlock_lock(&worker->lock);
+    list_splice(&worker->lwt.head, &lwt_head);
+    list_splice(&worker->job, &job_head);
+    worker->lwt.wait = 0;
+    spinlock_unlock(&worker->lock);
+
+    /* 上一轮本worker内唤醒的lwt排在本轮队尾，本轮唤醒的留到下一轮，避免饿死其他lwt */
+    list_splice_tail(&worker->lwt.local, &lwt_head);
+
+    worker_curr = worker;
+
+    /* job直接在worker栈上执行，执行后job内存可能被释放 */
+    while (!list_empty(&job_head))
+    {
+        _cojob_t *job = container_of(job_head.next, _cojob_t, link);
+        list_del(&job->link);
+        job->func(job->args);
+    }
+
+    for (;;)
+    {
+        /* 1. 优先调度next，next继承当前时间片，时间片用完或连续次数超限时放入队尾 */
+        _lwt_t *lwt = worker->lwt.next;
+        worker->lwt.next = NULL;
+        if ((NULL != lwt)
+            && (atomic_bool_fetch(&worker->preempt) || (worker->lwt.chain >= RUNNEXT_MAX)))
+        {
+            list_add_tail(&lwt->link, &worker->lwt.local);
+            lwt = NULL;
+        }
+
+        uint64_t tick = atomic_u64_fetch(&worker->mgr->watchdog.tick);
+        if (NULL != lwt)
+        {
+            worker->lwt.chain++;
+        }
+        else
+        {
+            /* 2. 从本轮队列中取出lwt */
+            if (list_empty(&lwt_head))
+            {
+                break;
+            }
+
+            lwt = container_of(lwt_head.next, _lwt_t, link);
+            list_del(&lwt->link);
+
+            worker->lwt.chain = 0;
+            worker->run.slice = tick;
+            atomic_bool_store(&worker->preempt, false);
+        }
+
+        /* 3. 调度执行 */
+        LWT_END(worker->mgr, LwtQue, lwt->ts);
+
+        lwt_curr = lwt;
+
+        worker->swapped = false;
+        worker->run.tick = tick;
+        worker->run.func = lwt->func;
+        (void)atomic_u64_inc(&worker->run.seq);
+
+        if (worker->mgr->shared)
+        {
+            _stack_switch(worker, lwt);
+        }
+
+        LWT_BEGIN(worker->mgr, LwtRun, &worker->ts);
+        if (0 != swapcontext(&worker->ctx, &lwt->ctx))
+        {
+            log_error("swapcontext fail, err(%s)", strerror(errno));
+        }
+
+        worker->run.func = NULL;
+
+        if (worker->swapped)
+        {
+            LWT_END(worker->mgr, LwtSche, worker->ts);
+            continue;
+        }
+
+        LWT_END(worker->mgr, LwtRun, worker->ts);
+
+        if (lwt->poison)
+        {
+            _stack_measure(worker, lwt);
+        }
+
+        /* 释放lwt空间之后调用外部传入的finish方法 */
+        void *_args = lwt->args;
+        coroutine_func _fini = lwt->fini;
+        _coscope_t *_scope = lwt->scope;
+        arena_t *_arena = lwt->arena;
+        lwt_curr = NULL;
+        _stack_release(worker, lwt);
+        _lwt_free(worker->mgr, lwt);
+
+        /* fini中仍可通过arena_lwt访问lwt在arena中申请的内存 */
+        worker->arena = _arena;
+        if (NULL != _fini)
+        {
+            _fini(_args);
+        }
+
+        worker->arena = NULL;
+        arena_destroy(_arena);
+
+        /* 最后一个子lwt结束时唤醒正在join的父lwt */
+        if ((NULL != _scope) && (0 == atomic_s32_dec(&_scope->pending)))
+        {
+            (void)cosem_up(&_scope->sem);
+        }
+
+        (void)atomic_s32_dec(&worker->lwt.count);
+    }
+
+    lwt_curr = NULL;
+    worker_curr = NULL;
+}
+
+static void _worker_cleanup(void *args)
+{
+    _worker_t *worker = (_worker_t *)args;
+
+    /* 1. 清空未调度的lwt，已被唤醒但仍挂在sem队列中的lwt由步骤3恢复执行，不能释放 */
+    spinlock_lock(&worker->lock);
+    worker->lwt.wait = 0;
+
+    /* 本worker内唤醒的lwt一并清理 */
+    list_splice_tail(&worker->lwt.local, &worker->lwt.head);
+    if (NULL != worker->lwt.next)
+    {
+        list_add_tail(&worker->lwt.next->link, &worker->lwt.head);
+        worker->lwt.next = NULL;
+    }
+
+    while (!list_empty(&worker->lwt.head))
+    {
+        _lwt_t *lwt = container_of(worker->lwt.head.next, _lwt_t, link);
+        list_del(&lwt->link);
+        if (!list_empty(&lwt->blocked.link))
+        {
+            continue;
+        }
+
+        arena_destroy(lwt->arena);
+        _stack_release(worker, lwt);
+        mempool_free(worker->mgr->mem, lwt);
+        (void)atomic_s32_dec(&worker->lwt.count);
+    }
+
+    /* job内存属于调用者，直接丢弃 */
+    list_init(&worker->job);
+    spinlock_unlock(&worker->lock);
+
+    /* 2. 归还缓存的lwt */
+    while (0 != worker->cache.count)
+    {
+        mempool_free(worker->mgr->mem, worker->cache.list[--(worker->cache.count)]);
+    }
+
+    /* 3. 唤醒所有的信号量，返回失败(由cosem_down自行出队) */
+    while (!list_empty(&worker->sem.head))
+    {
+        _lwt_t *lwt = container_of(worker->sem.head.next, _lwt_t, blocked.link);
+        lwt->blocked.ret = -1;
+        if (worker->mgr->shared)
+        {
+            _stack_switch(worker, lwt);
+        }
+
+        if (0 != swapcontext(&worker->ctx, &lwt->ctx))
+        {
+            log_error("swapcontext fail, err(%s)", strerror(errno));
+        }
+    }
+}
+
+static int _worker_need_sleep(void *args)
+{
+    _worker_t *worker = (_worker_t *)args;
+    return ((0 == atomic_s32_fetch(&worker->lwt.wait))
+            && list_empty(&worker->lwt.local)) ? 1 : 0;
+}
+
+static int _worker_init(comgr_t *mgr)
+{
+    mgr->worker.list = (_worker_t *)calloc(mgr->worker.count, sizeof(_worker_t));
+    if (NULL == mgr->worker.list)
+    {
+        log_error("calloc fail");
+        return -1;
+    }
+
+    uint32_t i = 0;
+    for (; i < mgr->worker.count; i++)
+    {
+        char name[CLEN_MAX * 2] = {0};
+        sprintf_s(name, sizeof(name), "%.8s%d", mgr->name, i);
+        _worker_t *worker = &mgr->worker.list[i];
+        worker->ts = 0;
+        worker->mgr = mgr;
+        worker->stat = &mgr->stat.shard[i];
+        worker->lwt.count = 0;
+        worker->lwt.wait = 0;
+        list_init(&worker->lwt.head);
+        list_init(&worker->lwt.local);
+        worker->lwt.next = NULL;
+        worker->lwt.chain = 0;
+        list_init(&worker->job);
+
+        worker->sem.count = 0;
+        list_init(&worker->sem.head);
+
+        worker->cache.count = 0;
+        worker->arena = NULL;
+
+        worker->stack.owner = NULL;
+        worker->stack.base = NULL;
+        if (mgr->shared
+            && (0 != posix_memalign(&worker->stack.base, STACK_PAGE, mgr->stack_size)))
+        {
+            log_error("posix_memalign fail");
+            worker->stack.base = NULL;
+            break;
+        }
+
+        spinlock_init(&worker->lock);
+
+        /* 成员初始化完成之后再启动线程，线程启动即会检查调度队列 */
+        worker->thread = threadraw_create(name,
+                                        worker,
+                                        _worker_svc,
+                                        _worker_cleanup,
+                                        _worker_need_sleep);
+        if (NULL == worker->thread)
+        {
+            log_error("threadraw_create fail");
+            spinlock_destroy(&worker->lock);
+            free(worker->stack.base);
+            break;
+        }
+    }
+
+    if (mgr->worker.count != i)
+    {
+        for (uint32_t j = 0; j < i; j++)
+        {
+            threadraw_destroy(mgr->worker.list[j].thread);
+            free(mgr->worker.list[j].stack.base);
+        }
+
+        free(mgr->worker.list);
+        mgr->worker.list = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void _worker_fini(comgr_t *mgr)
+{
+    for (uint32_t i = 0; i < mgr->worker.count; i++)
+    {
+        threadraw_destroy(mgr->worker.list[i].thread);
+        spinlock_destroy(&mgr->worker.list[i].lock);
+        free(mgr->worker.list[i].stack.base);
+    }
+
+    free(mgr->worker.list);
+    mgr->worker.list = NULL;
+}
+
+static inline void _lwt_setup(comgr_t *mgr,
+                            _lwt_t *lwt,
+                            _worker_t *worker,
+                            void *args,
+                            coroutine_func func,
+                            coroutine_func fini)
+{
+    lwt->args = args;
+    lwt->func = func;
+    lwt->fini = fini;
+    lwt->worker = worker;
+    lwt->scope = NULL;
+    lwt->arena = NULL;
+    lwt->select.state = SELECT_IDLE;
+    lwt->select.acks = 0;
+    list_init(&lwt->blocked.link);
+    lwt->blocked.ret = 0;
+
+    lwt->ctx.uc_stack.ss_size = mgr->stack_size;
+    lwt->ctx.uc_link = &worker->ctx;
+
+    lwt->save.size = 0;
+    lwt->save.cap = 0;
+    lwt->save.buf = NULL;
+
+    /* 共享栈模式下makecontext会改写栈，推迟到首次调度时执行 */
+    if (mgr->shared)
+    {
+        lwt->ctx.uc_stack.ss_sp = worker->stack.base;
+        lwt->poison = false;
+        lwt->save.start = true;
+        return;
+    }
+
+    lwt->ctx.uc_stack.ss_sp = (lwt + 1);
+    lwt->save.start = false;
+
+    lwt->poison = _stack_sample(mgr);
+    if (lwt->poison)
+    {
+        _stack_poison(mgr, lwt);
+    }
+
+    _lwt_make(lwt);
+}
+
+static inline void _lwt_ctxcopy(_lwt_t *lwt, const ucontext_t *ctx)
+{
+    lwt->ctx = *ctx;
+#ifdef __x86_64__
+    /* glibc中fpregs指向ucontext自身的浮点寄存器区，拷贝后需修正 */
+    lwt->ctx.uc_mcontext.fpregs = &lwt->ctx.__fpregs_mem;
+#endif
+}
+
+static inline void _comgr_cleanup(comgr_t *mgr)
+{
+    _timer_cleanup(mgr);
+    if (NULL != mgr->sleeper.timer)
+    {
+        stimer_destroy(mgr->sleeper.timer);
+    }
+
+    if (NULL != mgr->worker.list)
+    {
+        _worker_fini(mgr);
+    }
+
+    if (NULL != mgr->mem)
+    {
+        mempool_destroy(mgr->mem);
+    }
+
+    if (NULL != mgr->info)
+    {
+        free(mgr->info);
+    }
+
+    if (NULL != mgr->stat.shard)
+    {
+        free(mgr->stat.shard);
+    }
+
+    if (NULL != mgr->name)
+    {
+        free(mgr->name);
+    }
+
+    spinlock_destroy(&mgr->watchdog.lock);
+}
+
+/*************************************************************************
+*************************************************************************/
 
-        spinlock_init(&worker->lock);
+static void _lwt_wakeup(_worker_t *worker, _lwt_t *lwt)
+{
+    /* 1. 同一worker内唤醒，worker必然处于运行态，放入next，原next进入本地队列 */
+    if (worker_curr == worker)
+    {
+        if (NULL != worker->lwt.next)
+        {
+            list_add_tail(&worker->lwt.next->link, &worker->lwt.local);
+        }
+
+        worker->lwt.next = lwt;
+        return;
     }
 
-    if (mgr->worker.count != i)
+    /* 2. 跨worker唤醒，将lwt加入worker中的调度队列 */
+    spinlock_lock(&worker->lock);
+    list_add(&lwt->link, &worker->lwt.head);
+    ++(worker->lwt.wait);
+    spinlock_unlock(&worker->lock);
+
+    /* 3. 唤醒worker(worker未睡眠时不会产生系统调用) */
+    threadraw_wakeup(worker->thread);
+}
+
+int cosem_special(void)
+{
+    return (NULL == lwt_curr) ? 0 : 1;
+}
+
+/* 共享栈会被同一worker上的其他lwt占用，其上的对象不能被其他lwt或线程访问 */
+static inline bool _on_shared_stack(const void *addr)
+{
+    _worker_t *worker = lwt_curr->worker;
+    const char *base = (const char *)worker->stack.base;
+    return worker->mgr->shared
+        && ((const char *)addr >= base)
+        && ((const char *)addr < base + worker->mgr->stack_size);
+}
+
+int cosem_init(void *sem)
+{
+    if (NULL == lwt_curr)
     {
-        for (uint32_t j = 0; j < i; j++)
+        log_error("not coroutine context");
+        return -1;
+    }
+
+    if (_on_shared_stack(sem))
+    {
+        log_error("coroutine semaphore %p is on shared stack", sem);
+        return -1;
+    }
+
+    _cosem_t *cosem = (_cosem_t *)sem;
+
+    cosem->lwt = lwt_curr;
+    cosem->val = 0;
+    return 0;
+}
+
+int cosem_fini(void *sem)
+{
+    _cosem_t *cosem = (_cosem_t *)sem;
+    if (0 != cosem->val)
+    {
+        log_error("coroutine semaphore is still in use(%d)", cosem->val);
+        return -1;
+    }
+
+    cosem->lwt = NULL;
+    cosem->val = 0;
+
+    return 0;
+}
+
+int cosem_up(void *sem)
+{
+    _cosem_t *cosem = (_cosem_t *)sem;
+    if (NULL == cosem->lwt)
+    {
+        log_error("coroutine semaphore belongs to no lwt");
+        return -1;
+    }
+
+    _lwt_t *lwt = cosem->lwt;
+    _worker_t *worker = lwt->worker;
+
+    /* 1. 判断是否能够唤醒coroutine sem，只有val为0时才能唤醒 */
+    int32_t val = atomic_s32_dec(&cosem->val);
+    if (SELECT_BIAS - 1 == val)
+    {
+        /* co_select登记后的第一个up，与其他信号量竞争唤醒lwt */
+        uint32_t index = cosem->index;
+        if (!atomic_s32_cas(&lwt->select.state, SELECT_WAIT, (int32_t)index, NULL))
         {
-            threadraw_destroy(mgr->worker.list[j].thread);
+            /* 竞争失败后不能再访问cosem和lwt */
+            (void)atomic_s32_inc(&lwt->select.acks);
+            return 0;
         }
+    }
+    else if (0 != val)
+    {
+        return 0;
+    }
 
-        free(mgr->worker.list);
-        mgr->worker.list = NULL;
+    LWT_BEGIN(worker->mgr, LwtSemup, &cosem->ts);
+    LWT_BEGIN(worker->mgr, LwtQue, &lwt->ts);
+    _lwt_wakeup(worker, lwt);
+    return 0;
+}
+
+static int _cosem_down(void *sem, uintptr_t site)
+{
+    _cosem_t *cosem = (_cosem_t *)sem;
+    if (NULL == cosem->lwt)
+    {
+        log_error("coroutine semaphore belongs to no lwt");
         return -1;
     }
 
-    return 0;
+    _worker_t *worker = cosem->lwt->worker;
+    LWT_END(worker->mgr, LwtRun, worker->ts);
+
+    /* 1. 如果val值小于等于0， 表明up操作先于down执行，直接返回即可 */
+    if (0 >= atomic_s32_inc(&cosem->val))
+    {
+        return 0;
+    }
+
+    /* 2. coroutine sem加入worker中的相关队列(仅worker线程访问) */
+    worker->swapped = true;
+    LWT_BEGIN(worker->mgr, LwtSche, &worker->ts);
+    cosem->lwt->blocked.ret = 0;
+    list_add_tail(&cosem->lwt->blocked.link, &worker->sem.head);
+    ++(worker->sem.count);
+    _block_begin(worker, cosem->lwt, BlockSem, site);
+
+    /* 3. 切换调度，up操作只负责将lwt入队，不会访问sem队列 */
+    if (0 != swapcontext(&cosem->lwt->ctx, &worker->ctx))
+    {
+        log_error("swapcontext fail, err(%s)", strerror(errno));
+    }
+
+    _block_end(worker, cosem->lwt);
+    list_del(&cosem->lwt->blocked.link);
+    --(worker->sem.count);
+
+    LWT_END(worker->mgr, LwtSemup, cosem->ts);
+
+    return cosem->lwt->blocked.ret;
 }
 
-static void _worker_fini(comgr_t *mgr)
+int cosem_down(void *sem)
 {
-    for (uint32_t i = 0; i < mgr->worker.count; i++)
+    return _cosem_down(sem, WAIT_SITE());
+}
+
+void cosem_sleep(uint32_t ms)
+{
+    uintptr_t site = WAIT_SITE();
+    if (NULL == lwt_curr)
     {
-        threadraw_destroy(mgr->worker.list[i].thread);
-        spinlock_destroy(&mgr->worker.list[i].lock);
+        log_error("not coroutine context");
+        return;
     }
 
-    free(mgr->worker.list);
-    mgr->worker.list = NULL;
+    /* 1. 加入超时列表 */
+    _sleeper_t *sleeper = &lwt_curr->sleeper;
+    sleeper->lwt = lwt_curr;
+    sleeper->timeout = ms;
+    sleeper->select = false;
+
+    comgr_t *mgr = lwt_curr->worker->mgr;
+    _sleeper_add(mgr, sleeper);
+
+    /* 2. 切换lwt */
+    LWT_END(mgr, LwtRun, lwt_curr->worker->ts);
+    lwt_curr->worker->swapped = true;
+    _block_begin(lwt_curr->worker, lwt_curr, BlockSleep, site);
+
+    if (0 != swapcontext(&lwt_curr->ctx, &lwt_curr->worker->ctx))
+    {
+        log_error("swapcontext fail, err(%s)", strerror(errno));
+    }
+
+    _block_end(lwt_curr->worker, lwt_curr);
 }
 
-static void _lwt_func(uint32_t low, uint32_t hig)
+static inline int _select_try(_cosem_t *cosem)
 {
-    uintptr_t ptr = (uintptr_t)low | ((uintptr_t)hig << 32);
-    _lwt_t *lwt = (_lwt_t *)ptr;
+    /* val小于0表示有未消耗的up */
+    int32_t val = atomic_s32_fetch(&cosem->val);
+    while (val < 0)
+    {
+        if (atomic_s32_cas(&cosem->val, val, val + 1, NULL))
+        {
+            return 0;
+        }
 
-    lwt->func(lwt->args);
+        val = atomic_s32_fetch(&cosem->val);
+    }
+
+    return -1;
 }
 
-static inline void _comgr_cleanup(comgr_t *mgr)
+static int _select_any(_cosem_t **sems, uint32_t n, uint32_t ms, uintptr_t site)
 {
-    _timer_cleanup(mgr);
-    if (NULL != mgr->sleeper.timer)
+    _lwt_t *lwt = lwt_curr;
+    _worker_t *worker = lwt->worker;
+    comgr_t *mgr = worker->mgr;
+
+    /* 1. 已有up的信号量直接消耗，不需切换 */
+    for (uint32_t i = 0; i < n; i++)
     {
-        stimer_destroy(mgr->sleeper.timer);
+        if (0 == _select_try(sems[i]))
+        {
+            return (int)i;
+        }
     }
 
-    if (NULL != mgr->worker.list)
+    /* 2. 依次登记到各信号量，登记期间有up到达时自行竞争 */
+    atomic_s32_store(&lwt->select.acks, 0);
+    atomic_s32_store(&lwt->select.state, SELECT_WAIT);
+
+    uint32_t count = 0;
+    uint32_t early = n;
+    while (count < n)
     {
-        _worker_fini(mgr);
+        _cosem_t *cosem = sems[count];
+        cosem->index = count;
+        count++;
+        if (SELECT_BIAS != atomic_s32_add(&cosem->val, SELECT_BIAS))
+        {
+            early = count - 1;
+            break;
+        }
     }
 
-    if (NULL != mgr->mem)
+    bool self = ((n != early)
+                && atomic_s32_cas(&lwt->select.state, SELECT_WAIT, (int32_t)early, NULL));
+
+    /* 3. 未能自行唤醒时挂起，超时由定时器竞争唤醒 */
+    _sleeper_t *sleeper = &lwt->sleeper;
+    sleeper->lwt = lwt;
+    sleeper->timeout = ms;
+    sleeper->select = true;
+    list_init(&sleeper->link);
+    if (!self)
     {
-        mempool_destroy(mgr->mem);
+        if ((0 != ms) && (n == early))
+        {
+            _sleeper_add(mgr, sleeper);
+        }
+
+        LWT_END(mgr, LwtRun, worker->ts);
+        worker->swapped = true;
+        LWT_BEGIN(mgr, LwtSche, &worker->ts);
+        lwt->blocked.ret = 0;
+        list_add_tail(&lwt->blocked.link, &worker->sem.head);
+        ++(worker->sem.count);
+        _block_begin(worker, lwt, BlockSelect, site);
+
+        if (0 != swapcontext(&lwt->ctx, &worker->ctx))
+        {
+            log_error("swapcontext fail, err(%s)", strerror(errno));
+        }
+
+        _block_end(worker, lwt);
+        list_del(&lwt->blocked.link);
+        --(worker->sem.count);
+        _sleeper_del(mgr, sleeper);
     }
 
-    if (NULL != mgr->info)
+    /* 4. worker退出时未经竞争直接切回，阻止后续的up再次唤醒 */
+    (void)atomic_s32_cas(&lwt->select.state, SELECT_WAIT, SELECT_CANCEL, NULL);
+    int32_t win = atomic_s32_fetch(&lwt->select.state);
+
+    /* 5. 撤销登记，获胜的信号量消耗一次up；
+     *    登记后才到达的up若竞争失败会累加acks，需等待其结束访问 */
+    int32_t lost = 0;
+    for (uint32_t i = 0; i < count; i++)
     {
-        free(mgr->info);
+        int32_t val = atomic_s32_add(&sems[i]->val,
+                                    (win == (int32_t)i) ? (1 - SELECT_BIAS) : -SELECT_BIAS);
+        if ((win != (int32_t)i) && (early != i) && (val < 0))
+        {
+            lost++;
+        }
+    }
+
+    while (atomic_s32_fetch(&lwt->select.acks) != lost)
+    {
+        (void)sched_yield();
+    }
+
+    atomic_s32_store(&lwt->select.state, SELECT_IDLE);
+
+    if (win >= 0)
+    {
+        if (!self)
+        {
+            LWT_END(mgr, LwtSemup, sems[win]->ts);
+        }
+
+        return win;
+    }
+
+    return (SELECT_TIMEOUT == win) ? COSEL_TIMEOUT : lwt->blocked.ret;
+}
+
+int co_select(void **sems, uint32_t n, bool all, uint32_t ms)
+{
+    uintptr_t site = WAIT_SITE();
+    if (NULL == lwt_curr)
+    {
+        log_error("not coroutine context");
+        return -1;
+    }
+
+    _cosem_t **cosems = (_cosem_t **)sems;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (cosems[i]->lwt != lwt_curr)
+        {
+            log_error("coroutine semaphore %u belongs to other lwt", i);
+            return -1;
+        }
+    }
+
+    if (!all)
+    {
+        return (0 == n) ? -1 : _select_any(cosems, n, ms, site);
+    }
+
+    /* 全部等待时逐个等待，超时按定时器tick计算剩余时间，已就绪的up不会退回 */
+    uint64_t start = atomic_u64_fetch(&lwt_curr->worker->mgr->watchdog.tick);
+    for (uint32_t i = 0; i < n; i++)
+    {
+        uint32_t left = 0;
+        if (0 != ms)
+        {
+            uint64_t used = atomic_u64_fetch(&lwt_curr->worker->mgr->watchdog.tick) - start;
+            if (used >= ms)
+            {
+                if (0 != _select_try(cosems[i]))
+                {
+                    return COSEL_TIMEOUT;
+                }
+
+                continue;
+            }
+
+            left = (uint32_t)(ms - used);
+        }
+
+        int ret = _select_any(&cosems[i], 1, left, site);
+        if (0 != ret)
+        {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+int cosem_timeddown(void *sem, uint32_t ms)
+{
+    uintptr_t site = WAIT_SITE();
+    _cosem_t *cosem = (_cosem_t *)sem;
+    if ((NULL == lwt_curr) || (cosem->lwt != lwt_curr))
+    {
+        log_error("coroutine semaphore belongs to other lwt");
+        return EINVAL;
+    }
+
+    /* ms为0时只尝试消耗已到达的up */
+    if (0 == ms)
+    {
+        return (0 == _select_try(cosem)) ? 0 : ETIMEDOUT;
+    }
+
+    return (0 == _select_any(&cosem, 1, ms, site)) ? 0 : ETIMEDOUT;
+}
+
+/*************************************************************************
+*************************************************************************/
+
+static int _coroutine_run(comgr_t *mgr,
+                        void *args,
+                        coroutine_func func,
+                        coroutine_func fini,
+                        _coscope_t *scope)
+{
+    /* 在本管理器的worker上创建时，next为空或有缓存的lwt则留在本worker，
+     * 其余情况轮询选择worker */
+    _worker_t *worker = worker_curr;
+    bool local = ((NULL != worker) && (worker->mgr == mgr)
+                && ((NULL == worker->lwt.next) || (0 != worker->cache.count)));
+    if (!local)
+    {
+        worker = _choose_worker(mgr);
+    }
+
+    _lwt_t *lwt = _lwt_alloc(mgr, worker);
+    if (NULL == lwt)
+    {
+        log_error("lwt used up");
+        return -1;
+    }
+
+    if (0 != getcontext(&lwt->ctx))
+    {
+        log_error("getcontext fail, err(%s)", strerror(errno));
+        _lwt_free(mgr, lwt);
+        return -1;
+    }
+
+    _lwt_setup(mgr, lwt, worker, args, func, fini);
+    lwt->scope = scope;
+
+    /* 留在本worker时放入next，next已被占用则进入本地队列 */
+    if (local)
+    {
+        LWT_BEGIN(mgr, LwtQue, &lwt->ts);
+        (void)atomic_s32_inc(&worker->lwt.count);
+        if (NULL == worker->lwt.next)
+        {
+            worker->lwt.next = lwt;
+        }
+        else
+        {
+            list_add_tail(&lwt->link, &worker->lwt.local);
+        }
+
+        return 0;
+    }
+
+    spinlock_lock(&worker->lock);
+    {
+        LWT_BEGIN(mgr, LwtQue, &lwt->ts);
+        list_add_tail(&lwt->link, &worker->lwt.head);
+        worker->lwt.wait++;
+        (void)atomic_s32_inc(&worker->lwt.count);
     }
+    spinlock_unlock(&worker->lock);
 
-    if (NULL != mgr->name)
-    {
-        free(mgr->name);
-    }
+    threadraw_wakeup(worker->thread);
+    return 0;
 }
 
 /*************************************************************************
 *************************************************************************/
 
-int cosem_special(void)
-{
-    return (NULL == lwt_curr) ? 0 : 1;
-}
-
-int cosem_init(void *sem)
+int co_scope_init(coscope_t scope)
 {
     if (NULL == lwt_curr)
     {
@@ -444,156 +1698,102 @@ int cosem_init(void *sem)
         return -1;
     }
 
-    _cosem_t *cosem = (_cosem_t *)sem;
-
-    cosem->lwt = lwt_curr;
-    cosem->val = 0;
-    cosem->ret = 0;
-    list_init(&cosem->link);
-    return 0;
-}
-
-int cosem_fini(void *sem)
-{
-    _cosem_t *cosem = (_cosem_t *)sem;
-    if (!list_empty(&cosem->link) || (0 != cosem->val))
+    _coscope_t *local = (_coscope_t *)(void *)scope;
+    if (0 != cosem_init(&local->sem))
     {
-        log_error("coroutine semaphore is still in use(%d)", cosem->val);
         return -1;
     }
 
-    cosem->lwt = NULL;
-    cosem->val = 0;
-
+    local->pending = 1;
+    local->mgr = lwt_curr->worker->mgr;
     return 0;
 }
 
-int cosem_up(void *sem)
+int co_scope_fini(coscope_t scope)
 {
-    _cosem_t *cosem = (_cosem_t *)sem;
-    if (NULL == cosem->lwt)
+    _coscope_t *local = (_coscope_t *)(void *)scope;
+    if (1 != atomic_s32_fetch(&local->pending))
     {
-        log_error("coroutine semaphore belongs to no lwt");
+        log_error("coroutine scope still has %d children", local->pending - 1);
         return -1;
     }
 
-    _worker_t *worker = cosem->lwt->worker;
-
-    /* 1. 需要在coroutine sem锁形成的互斥区中执行一系列操作 */
-    spinlock_lock(&worker->lock);
-    {
-        /* 1.1 判断是否能够唤醒coroutine sem，只有val为0时才能唤醒 */
-        --(cosem->val);
-        if (0 != cosem->val)
-        {
-            spinlock_unlock(&worker->lock);
-            return 0;
-        }
+    return cosem_fini(&local->sem);
+}
 
-        /* 1.2 将coroutine sem从worker中的队列移除 */
-        LWT_BEGIN(worker->mgr, LwtSemup, &cosem->ts);
-        list_del(&cosem->link);
-        --(worker->sem.count);
+int co_spawn(coscope_t scope, void *args, coroutine_func func)
+{
+    _coscope_t *local = (_coscope_t *)(void *)scope;
 
-        /* 1.3 将coroutine sem对应的lwt加入worker中的调度队列 */
-        LWT_BEGIN(worker->mgr, LwtQue, &cosem->lwt->ts);
-        list_add(&cosem->lwt->link, &worker->lwt.head);
-        ++(worker->lwt.wait);
+    /* 父lwt持有引用，这里的增减不会使pending归零 */
+    (void)atomic_s32_inc(&local->pending);
+    if (0 != _coroutine_run(local->mgr, args, func, NULL, local))
+    {
+        (void)atomic_s32_dec(&local->pending);
+        return -1;
     }
-    spinlock_unlock(&worker->lock);
 
-    /* 2. 唤醒worker */
-    threadraw_wakeup(worker->thread);
     return 0;
 }
 
-int cosem_down(void *sem)
+int co_join(coscope_t scope)
 {
-    _cosem_t *cosem = (_cosem_t *)sem;
-    if (NULL == cosem->lwt)
-    {
-        log_error("coroutine semaphore belongs to no lwt");
-        return -1;
-    }
-
-    _worker_t *worker = cosem->lwt->worker;
-    LWT_END(worker->mgr, LwtRun, worker->ts);
+    _coscope_t *local = (_coscope_t *)(void *)scope;
 
-    /* 1. 需要在coroutine sem锁形成的互斥区中执行一系列的操作 */
-    spinlock_lock(&worker->lock);
+    /* 释放父lwt的引用，仍有子lwt未结束时等待最后一个子lwt唤醒 */
+    int ret = 0;
+    if (0 != atomic_s32_dec(&local->pending))
     {
-        /* 1.1 如果val值小于等于0， 表明up操作先于down执行，直接返回即可 */
-        ++(cosem->val);
-        if (0 >= cosem->val)
-        {
-            spinlock_unlock(&worker->lock);
-            return 0;
-        }
-
-        /* 1.2 coroutine sem需要加入worker中的相关队列(调测用途) */
-        worker->swapped = true;
-        LWT_BEGIN(worker->mgr, LwtSche, &worker->ts);
-        list_add_tail(&cosem->link, &worker->sem.head);
-        ++(worker->sem.count);
+        ret = _cosem_down(&local->sem, WAIT_SITE());
     }
-    spinlock_unlock(&worker->lock);
 
-    /* 2. 切换调度 */
-    if (0 != swapcontext(&cosem->lwt->ctx, &worker->ctx))
-    {
-        log_error("swapcontext fail, err(%s)", strerror(errno));
-    }
+    /* 重新持有引用，scope可以继续使用 */
+    atomic_s32_store(&local->pending, 1);
+    return ret;
+}
 
-    LWT_END(worker->mgr, LwtSemup, cosem->ts);
+static void _offload_svc(void *args)
+{
+    _offload_t *off = (_offload_t *)args;
+    off->func(off->args);
 
-    return cosem->ret;
+    /* up之后发起lwt可能立即释放off，不能再访问off */
+    (void)cosem_up(&off->sem);
 }
 
-void cosem_sleep(uint32_t ms)
+int co_offload(threadpool_t *pool, work_func func, void *args)
 {
+    /* 非lwt上下文阻塞不影响worker，直接执行 */
     if (NULL == lwt_curr)
     {
-        log_error("not coroutine context");
-        return;
+        func(args);
+        return 0;
     }
 
-    /* 1. 加入超时列表 */
-    _sleeper_t sleeper = {lwt_curr, ms, {NULL, NULL}};
-
-    comgr_t *mgr = lwt_curr->worker->mgr;
-    spinlock_lock(&mgr->sleeper.lock);
-    do
+    /* 线程池线程会访问，共享栈模式下不能放在lwt栈上 */
+    _offload_t *off = (_offload_t *)malloc(sizeof(_offload_t));
+    if (NULL == off)
     {
-        list_head_t *node;
-        list_foreach(node, &mgr->sleeper.list)
-        {
-            _sleeper_t *_slp = container_of(node, _sleeper_t, link);
-            if (_slp->timeout > sleeper.timeout)
-            {
-                _slp->timeout -= sleeper.timeout;
-                list_add(&sleeper.link, _slp->link.prev);
-                break;
-            }
-
-            sleeper.timeout -= _slp->timeout;
-        }
+        log_error("malloc fail");
+        return -1;
+    }
 
-        if (node == &mgr->sleeper.list)
-        {
-            list_add_tail(&sleeper.link, &mgr->sleeper.list);
-        }
+    if (0 != cosem_init(&off->sem))
+    {
+        free(off);
+        return -1;
+    }
 
-    } while(0);
-    spinlock_unlock(&mgr->sleeper.lock);
+    off->func = func;
+    off->args = args;
 
-    /* 2. 切换lwt */
-    LWT_END(mgr, LwtRun, lwt_curr->worker->ts);
-    lwt_curr->worker->swapped = true;
+    /* 线程池执行完成后跨worker唤醒，期间worker继续调度其他lwt */
+    threadpool_submit(pool, off, _offload_svc);
+    int ret = _cosem_down(&off->sem, WAIT_SITE());
 
-    if (0 != swapcontext(&lwt_curr->ctx, &lwt_curr->worker->ctx))
-    {
-        log_error("swapcontext fail, err(%s)", strerror(errno));
-    }
+    (void)cosem_fini(&off->sem);
+    free(off);
+    return ret;
 }
 
 /*************************************************************************
@@ -604,50 +1804,74 @@ int coroutine_run(comgr_t       *mgr,
                     coroutine_func  func,
                     coroutine_func  fini)
 {
-    _lwt_t *lwt = mempool_alloc(mgr->mem);
-    if (NULL == lwt)
+    return _coroutine_run(mgr, args, func, fini, NULL);
+}
+
+int coroutine_run_batch(comgr_t     *mgr,
+                        uint32_t    n,
+                        void        **args,
+                        coroutine_func  func,
+                        coroutine_func  fini)
+{
+    /* 1. 只获取一次上下文，所有lwt以此为模板 */
+    ucontext_t tmpl;
+    if (0 != getcontext(&tmpl))
     {
-        log_error("lwt used up");
+        log_error("getcontext fail, err(%s)", strerror(errno));
         return -1;
     }
 
-    _worker_t *worker = _choose_worker(mgr);
+    /* 2. 依次将lwt均分到各个worker，每个worker只加锁和唤醒一次 */
+    uint32_t total = 0;
+    uint32_t count = mgr->worker.count;
+    uint32_t start = (uint32_t)(_choose_worker(mgr) - mgr->worker.list);
+    for (uint32_t i = 0; (i < count) && (total < n); i++)
+    {
+        _worker_t *worker = &mgr->worker.list[(start + i) % count];
+        uint32_t num = n / count + ((i < n % count) ? 1 : 0);
 
-    lwt->args = args;
-    lwt->func = func;
-    lwt->fini = fini;
-    lwt->worker = worker;
+        list_head_t head;
+        list_init(&head);
 
-    if (0 != getcontext(&lwt->ctx))
-    {
-        log_error("getcontext fail, err(%s)", strerror(errno));
-        mempool_free(mgr->mem, lwt);
-        return -1;
-    }
+        uint32_t j = 0;
+        for (; j < num; j++, total++)
+        {
+            _lwt_t *lwt = _lwt_alloc(mgr, worker);
+            if (NULL == lwt)
+            {
+                log_error("lwt used up");
+                break;
+            }
 
-    lwt->ctx.uc_stack.ss_sp = (lwt + 1);
-    lwt->ctx.uc_stack.ss_size = mgr->stack_size;
-    lwt->ctx.uc_link = &worker->ctx;
+            _lwt_ctxcopy(lwt, &tmpl);
+            _lwt_setup(mgr, lwt, worker,
+                        (NULL == args) ? NULL : args[total], func, fini);
 
-    uintptr_t ptr = (uintptr_t)lwt;
-    makecontext(&lwt->ctx,
-                (void  (*)(void))_lwt_func,
-                2, (uint32_t)ptr, (uint32_t)(ptr >> 32));
+            LWT_BEGIN(mgr, LwtQue, &lwt->ts);
+            list_add_tail(&lwt->link, &head);
+        }
 
-    spinlock_lock(&worker->lock);
-    {
-        LWT_BEGIN(mgr, LwtQue, &lwt->ts);
-        list_add_tail(&lwt->link, &worker->lwt.head);
-        worker->lwt.wait++;
-        (void)atomic_s32_inc(&worker->lwt.count);
+        if (0 != j)
+        {
+            spinlock_lock(&worker->lock);
+            list_splice_tail(&head, &worker->lwt.head);
+            worker->lwt.wait += (int32_t)j;
+            (void)atomic_s32_add(&worker->lwt.count, (int32_t)j);
+            spinlock_unlock(&worker->lock);
+
+            threadraw_wakeup(worker->thread);
+        }
+
+        if (j != num)
+        {
+            break;
+        }
     }
-    spinlock_unlock(&worker->lock);
 
-    threadraw_wakeup(worker->thread);
-    return 0;
+    return (int)total;
 }
 
-void coroutine_yield()
+static void _coroutine_yield(uintptr_t site)
 {
     if (NULL == lwt_curr)
     {
@@ -658,6 +1882,7 @@ void coroutine_yield()
     _worker_t *worker = lwt_curr->worker;
     LWT_END(worker->mgr, LwtRun, worker->ts);
 
+    _block_begin(worker, lwt_curr, BlockYield, site);
     spinlock_lock(&worker->lock);
     {
         worker->swapped = true;
@@ -671,12 +1896,85 @@ void coroutine_yield()
     {
         log_error("swapcontext fail, err(%s)", strerror(errno));
     }
+
+    _block_end(worker, lwt_curr);
+}
+
+void coroutine_maybe_yield()
+{
+    /* 时间片由看门狗在定时器中检测，此处只需检查标记 */
+    if ((NULL == lwt_curr) || !atomic_bool_fetch(&lwt_curr->worker->preempt))
+    {
+        return;
+    }
+
+    _coroutine_yield(WAIT_SITE());
+}
+
+void coroutine_yield()
+{
+    _coroutine_yield(WAIT_SITE());
+}
+
+arena_t *arena_lwt(void)
+{
+    _lwt_t *lwt = lwt_curr;
+    if (NULL == lwt)
+    {
+        /* 在fini中调用时返回已结束lwt的arena，lwt未创建过arena时使用线程的arena */
+        _worker_t *worker = worker_curr;
+        return ((NULL != worker) && (NULL != worker->arena)) ? worker->arena : arena_thread();
+    }
+
+    if (NULL == lwt->arena)
+    {
+        lwt->arena = arena_create(NULL);
+    }
+
+    return lwt->arena;
+}
+
+int comgr_post(comgr_t *mgr,
+                cojob_t job,
+                uint32_t ms,
+                coroutine_func func,
+                void *args)
+{
+    _cojob_t *local = (_cojob_t *)(void *)job;
+    local->func = func;
+    local->args = args;
+
+    /* 在本管理器的worker上投递时留在当前worker，其余情况轮询选择worker */
+    _worker_t *worker = worker_curr;
+    local->worker = ((NULL != worker) && (worker->mgr == mgr)) ? worker : _choose_worker(mgr);
+
+    if (0 == ms)
+    {
+        _job_queue(local, true);
+        return 0;
+    }
+
+    _sleeper_t *sleeper = &local->sleeper;
+    sleeper->lwt = NULL;
+    sleeper->timeout = ms;
+    sleeper->select = false;
+    _sleeper_add(mgr, sleeper);
+    return 0;
 }
 
 comgr_t *comgr_create(const char *name,
                     uint32_t max_lwt,
                     uint32_t max_worker,
                     uint32_t stack_size)
+{
+    return comgr_create_ex(name, max_lwt, max_worker, stack_size, 0);
+}
+
+comgr_t *comgr_create_ex(const char *name,
+                        uint32_t max_lwt,
+                        uint32_t max_worker,
+                        uint32_t stack_size,
+                        uint32_t flags)
 {
     /* 1. 分配mgr内存空间 */
     comgr_t *mgr = (comgr_t *)calloc(1, sizeof(comgr_t));
@@ -687,11 +1985,18 @@ comgr_t *comgr_create(const char *name,
     }
 
     mgr->stack_size = stack_size;
+    mgr->shared = (0 != (flags & COMGR_SHARED_STACK));
+    (void)pthread_once(&lwt_clock_once, _lwt_clock_calibrate);
+
+    mgr->watchdog.slice = DEF_SLICE;
+    mgr->watchdog.threshold = DEF_WATCHDOG;
+    spinlock_init(&mgr->watchdog.lock);
 
     /* 2. 创建lwt内存池 */
     max_lwt = (max_lwt < MIN_LWT) ? MIN_LWT : max_lwt;
-    uint32_t size = (uint32_t)sizeof(_lwt_t) + stack_size;
-    mgr->mem = mempool_create(size, max_lwt, NULL);
+    uint32_t size = (uint32_t)sizeof(_lwt_t) + (mgr->shared ? 0 : stack_size);
+    mgr->mem = mempool_create_ex(size, max_lwt, NULL,
+                                (flags & COMGR_HUGEPAGE) ? MEMPOOL_HUGEPAGE : 0);
     if (NULL == mgr->mem)
     {
         log_error("mempool_create fail");
@@ -705,6 +2010,24 @@ comgr_t *comgr_create(const char *name,
 
     max_worker = (max_worker < MIN_WORKER) ? MIN_WORKER : max_worker;
     mgr->worker.count = max_worker;
+
+    /* 缓存总量不超过lwt总数的1/4，避免外部线程申请不到lwt */
+    mgr->cache = max_lwt / (4 * max_worker);
+    mgr->cache = (mgr->cache > LWT_CACHE) ? LWT_CACHE : mgr->cache;
+
+    size_t ssize = (max_worker + 1) * sizeof(_lwtstat_t);
+    if (0 != posix_memalign((void **)&mgr->stat.shard, CACHELINE_SIZE, ssize))
+    {
+        log_error("posix_memalign fail");
+        mgr->stat.shard = NULL;
+        _comgr_cleanup(mgr);
+        free(mgr);
+        return NULL;
+    }
+
+    (void)memset_s(mgr->stat.shard, ssize, 0, ssize);
+    mgr->stat.enable = true;
+
     if (0 != _worker_init(mgr))
     {
         _comgr_cleanup(mgr);
@@ -742,6 +2065,7 @@ comgr_t *comgr_create(const char *name,
     mgr->info->worker.count = (uint32_t *)(mgr->info + 1);
     mgr->info->worker.total = mgr->worker.count;
     costat_register(mgr->name, mgr);
+    mempool_setname(mgr->mem, mgr->name);
 
     return mgr;
 }
@@ -766,10 +2090,112 @@ const coinfo_t *comgr_getinfo(comgr_t *mgr)
         info->worker.count[i] = (uint32_t)mgr->worker.list[i].lwt.count;
     }
 
+    /* 汇总各分片的统计信息，时延换算为微秒 */
+    for (int op = LwtQue; op < LwtEnd; op++)
+    {
+        lwtop_t *sum = &info->lwt.op[op];
+        (void)memset_s(sum, sizeof(lwtop_t), 0, sizeof(lwtop_t));
+
+        for (uint32_t i = 0; i <= mgr->worker.count; i++)
+        {
+            lwtop_t *lop = &mgr->stat.shard[i].op[op];
+            sum->begin += lop->begin;
+            sum->end += lop->end;
+            sum->delay += lop->delay;
+            sum->max = (lop->max > sum->max) ? lop->max : sum->max;
+        }
+
+        sum->delay /= lwt_clock_per_us;
+        sum->max /= lwt_clock_per_us;
+    }
+
+    /* 汇总栈水位，推荐值为最大水位的1.5倍并按页对齐 */
+    (void)memset_s(&info->stack, sizeof(info->stack), 0, sizeof(info->stack));
+    info->stack.size = mgr->stack_size;
+    info->stack.sample = atomic_u32_fetch(&mgr->stack.sample);
+    for (uint32_t i = 0; i <= mgr->worker.count; i++)
+    {
+        _lwtstat_t *shard = &mgr->stat.shard[i];
+        info->stack.count += shard->stack.count;
+        info->stack.max = (shard->stack.max > info->stack.max) ?
+                            shard->stack.max : info->stack.max;
+        for (int j = 0; j < STACK_BUCKETS; j++)
+        {
+            info->stack.hist[j] += shard->stack.hist[j];
+        }
+    }
+
+    if (0 != info->stack.count)
+    {
+        uint64_t recommend = info->stack.max + info->stack.max / 2;
+        info->stack.recommend = (recommend + STACK_PAGE - 1) / STACK_PAGE * STACK_PAGE;
+    }
+
+    /* 拷贝看门狗记录 */
+    spinlock_lock(&mgr->watchdog.lock);
+    info->watchdog.slice = mgr->watchdog.slice;
+    info->watchdog.threshold = mgr->watchdog.threshold;
+    info->watchdog.count = mgr->watchdog.count;
+    for (uint32_t i = 0; i < mgr->watchdog.count; i++)
+    {
+        info->watchdog.lwt[i].func = (uintptr_t)mgr->watchdog.lwt[i].func;
+        info->watchdog.lwt[i].times = mgr->watchdog.lwt[i].times;
+        info->watchdog.lwt[i].max = mgr->watchdog.lwt[i].max;
+    }
+    spinlock_unlock(&mgr->watchdog.lock);
+
+    /* 按阻塞点合并各worker的阻塞统计，超出记录数的计入溢出项 */
+    (void)memset_s(&info->block, sizeof(info->block), 0, sizeof(info->block));
+    for (uint32_t i = 0; i < mgr->worker.count; i++)
+    {
+        for (uint32_t j = 0; j <= BLOCK_SITES; j++)
+        {
+            coblock_t *entry = &mgr->stat.shard[i].block[j];
+            if ((0 == entry->count) && (0 >= entry->waiting))
+            {
+                continue;
+            }
+
+            uint32_t k = 0;
+            uintptr_t site = (BLOCK_SITES == j) ? 0 : entry->site;
+            while ((k < info->block.count)
+                && ((info->block.site[k].site != site) || (info->block.site[k].kind != entry->kind)))
+            {
+                k++;
+            }
+
+            if ((k == info->block.count) && (0 != site) && (k < BLOCK_SITES))
+            {
+                info->block.site[k].site = site;
+                info->block.site[k].kind = entry->kind;
+                info->block.count++;
+            }
+
+            coblock_t *sum = (k < info->block.count) ? &info->block.site[k] : &info->block.site[BLOCK_SITES];
+            sum->waiting += (entry->waiting > 0) ? entry->waiting : 0;
+            sum->count += entry->count;
+            sum->total += entry->total;
+            sum->max = (entry->max > sum->max) ? entry->max : sum->max;
+        }
+    }
+
+    for (uint32_t i = 0; i <= BLOCK_SITES; i++)
+    {
+        info->block.site[i].total /= lwt_clock_per_us;
+        info->block.site[i].max /= lwt_clock_per_us;
+    }
+
+    /* worker缓存中的lwt不计入已使用 */
+    uint32_t cached = 0;
+    for (uint32_t i = 0; i < mgr->worker.count; i++)
+    {
+        cached += mgr->worker.list[i].cache.count;
+    }
+
     mempool_info_t mem = {0};
     mempool_getinfo(mgr->mem, &mem);
     info->lwt.total = mem.total;
-    info->lwt.used = mem.used;
+    info->lwt.used = (mem.used > cached) ? (mem.used - cached) : 0;
 
     return info;
 }
@@ -779,4 +2205,34 @@ void comgr_resetinfo(comgr_t *mgr)
     coinfo_t *info = mgr->info;
     size_t size = sizeof(lwtop_t) * LwtEnd;
     (void)memset_s(info->lwt.op, size, 0, size);
+
+    /* 清零前开始的阻塞在恢复时不再统计 */
+    (void)atomic_u32_inc(&mgr->stat.gen);
+    size = (mgr->worker.count + 1) * sizeof(_lwtstat_t);
+    (void)memset_s(mgr->stat.shard, size, 0, size);
+
+    spinlock_lock(&mgr->watchdog.lock);
+    mgr->watchdog.count = 0;
+    spinlock_unlock(&mgr->watchdog.lock);
+}
+
+void comgr_setstat(comgr_t *mgr, bool enable)
+{
+    atomic_bool_store(&mgr->stat.enable, enable);
+}
+
+bool comgr_getstat(comgr_t *mgr)
+{
+    return atomic_bool_fetch(&mgr->stat.enable);
+}
+
+void comgr_setslice(comgr_t *mgr, uint32_t slice, uint32_t watchdog)
+{
+    atomic_u32_store(&mgr->watchdog.slice, slice);
+    atomic_u32_store(&mgr->watchdog.threshold, watchdog);
+}
+
+void comgr_stacksample(comgr_t *mgr, uint32_t sample)
+{
+    atomic_u32_store(&mgr->stack.sample, sample);
 }
@@ -110,14 +110,23 @@ static inline int _evict_begin(mc_t *mc)
     spinlock_lock(&mc->wait.lock);
     if (mc->wait.evicting)
     {
-        _waiter_t waiter;
-        sema_init(waiter.sem);
+        /* 等待者由其他线程唤醒并出队，共享栈模式下不能放在lwt栈上 */
+        _waiter_t *waiter = (_waiter_t *)malloc(sizeof(_waiter_t));
+        if (NULL == waiter)
+        {
+            spinlock_unlock(&mc->wait.lock);
+            log_error("malloc fail");
+            return -1;
+        }
+
+        sema_init(waiter->sem);
         mc->wait.count++;
-        list_add_tail(&waiter.link, &mc->wait.list);
+        list_add_tail(&waiter->link, &mc->wait.list);
         spinlock_unlock(&mc->wait.lock);
 
-        sema_down(waiter.sem);
-        sema_fini(waiter.sem);
+        sema_down(waiter->sem);
+        sema_fini(waiter->sem);
+        free(waiter);
 
         return -1;
     }
@@ -3,26 +3,68 @@
  * Created by Hongbo Li <lihb2113@outlook.com>
  */
 #include "mempool.h"
+#include "mpstat.h"
 #include "atomic.h"
+#include "sysdef.h"
 
 #include "bitmap.h"
+#include "stimer.h"
+#include "spinlock.h"
 #include "sema.h"
+#include "list.h"
 #include "log.h"
 
 #include "securec.h"
 
+#include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 
 #define MAX_CPUS        64U     /* 最大核数 */
-#define MIN_WAIT        1       /* 申请失败最小等待毫秒数 */
 #define MAX_WAIT        1024    /* 申请失败最大等待毫秒数 */
+#define MAG_SIZE        64U     /* 线程缓存容量上限 */
+#define SHRINK_DELAY    5000000000ULL   /* 空闲分段归还系统前的冷却纳秒数 */
+#define HUGE_PAGE       (2UL << 20)     /* 大页大小 */
+#define BULK_BATCH      64      /* 批量操作单次处理的位数 */
+#define GROW_SPREAD     4       /* 可增长模式下轮询的低位未满分段数 */
+#define NAME_LEN        32      /* mpstat中的名称长度 */
+#define MAX_NODES       64      /* 支持的最大NUMA节点数 */
+#define MAX_NODE_CPUS   4096    /* cpu到节点映射表大小 */
+#define NUMA_PREFERRED  1       /* MPOL_PREFERRED，节点内存不足时仍可使用其他节点 */
+#define STAT_SHARDS     8       /* 统计分片数 */
+
+/* 统计分片，线程按首次使用的顺序分散到各分片，减少计数的缓存行争用 */
+typedef struct
+{
+    uint64_t        alloc;
+    uint64_t        free;
+    uint64_t        fail;
+    uint64_t        wait;
+    uint64_t        timeout;
+    uint64_t        contended;
+    uint64_t        hist[MP_HIST_BUCKETS];
+}__cacheline_aligned _mpstat_t;
+
+/* 可增长模式下每个位图对应一个分段 */
+typedef struct
+{
+    uint32_t        bits;           /* 分段单元数 */
+    uint32_t        used;           /* 分段已分配数 */
+    uint64_t        idle;           /* 变为空闲的时间，0表示非空闲 */
+}_chunk_t;
 
 struct memorypool
 {
+    char            name[NAME_LEN]; /* mpstat中的名称，默认为mp@地址 */
     uint32_t        fix_size;       /* 内存单元长度 */
+    uint32_t        flags;          /* MEMPOOL_xxx */
 
     uint32_t        max;            /* 最大单元数 */
     uint32_t        used;           /* 已分配的数量 */
@@ -32,46 +74,1034 @@ struct memorypool
     int             b_cnt;          /* 位图数量 */
     bitmap_t      **b_map;          /* 位图指针数组 */
     char           *mem;            /* 内存空间 */
+
+    size_t          m_len;          /* 自行映射的内存长度，0表示随结构体分配或外部传入 */
+    size_t          m_page;         /* 映射内存的页大小 */
+    uint32_t        m_back;         /* MEMPOOL_BACK_xxx */
+    uint64_t        m_span;         /* 单元区域长度 */
+    uint64_t        m_seg;          /* 着色模式下每个分段的跨度，0表示不着色 */
+    uint32_t        m_color;        /* 着色数，分段i偏移(i % m_color)个m_unit */
+    uint32_t        m_unit;         /* 着色偏移单位 */
+    uint32_t        m_segs;         /* 分段数 */
+
+    int             n_cnt;          /* NUMA分区数，每个分区包含n_map个位图 */
+    int             n_map;
+
+    int             c_act;          /* 已启用的分段数，只在前c_act个分段中分配 */
+    uint64_t        c_check;        /* 上次尝试收缩的时间 */
+    spinlock_t      c_lock;         /* 分段扩展/收缩锁 */
+    bool            c_shrink;       /* 正在收缩，同一时间只有一个收缩者，受c_lock保护 */
+    _chunk_t       *c_info;         /* 分段信息 */
+    int            *c_seal;         /* 收缩时占满分段的位序号，按最大分段预留 */
+
+    uint64_t        f_head;         /* 空闲链表头：高32位为版本号，低32位为单元序号+1 */
+    uint8_t        *f_state;        /* 调试模式下各单元的分配状态 */
+
+    struct
+    {
+        spinlock_t  lock;
+        list_head_t head;           /* 等待释放的申请者 */
+        uint32_t    count;          /* 等待者数量，释放时无等待者不加锁 */
+    }wait;
+
+    struct
+    {
+        bool        enable;         /* 是否记录申请延迟 */
+        uint64_t    reset;          /* 上次重置统计的时间 */
+        _mpstat_t  *shard;
+    }stat;
+
+    struct
+    {
+        pthread_key_t   key;        /* 线程缓存，线程退出时归还 */
+        uint32_t        size;       /* 线程缓存容量，不超过MAG_SIZE */
+        uint32_t        batch;      /* 每次补充/归还的数量 */
+        spinlock_t      lock;
+        list_head_t     head;       /* 所有线程缓存，销毁时释放 */
+    }mag;
 };
 
+/* 线程缓存：LIFO数组，仅所属线程访问，批量从位图补充和归还 */
+typedef struct
+{
+    list_head_t     link;
+    mempool_t      *pool;
+    uint32_t        count;
+    void           *slot[MAG_SIZE];
+}_magazine_t;
+
+/* 等待者由释放者直接交付内存单元，lwt栈可能被换出(共享栈)，因此分配在堆上 */
+typedef struct
+{
+    list_head_t     link;
+    void           *mem;
+    sema_t          sem;
+}_mempool_waiter_t;
+
+/*************************************************************************
+*************************************************************************/
+
+static uint32_t g_stat_next = 0;
+static __thread uint32_t g_stat_shard = 0;
+
+static inline _mpstat_t *_stat_shard(mempool_t *pool)
+{
+    if (0 == g_stat_shard)
+    {
+        g_stat_shard = atomic_u32_inc(&g_stat_next);
+    }
+
+    return &pool->stat.shard[g_stat_shard % STAT_SHARDS];
+}
+
+/* 分片可能被多个线程共用，使用relaxed原子加 */
+static inline void _stat_add(uint64_t *var, uint64_t val)
+{
+    (void)__atomic_fetch_add(var, val, __ATOMIC_RELAXED);
+}
+
+/* begin为0表示未开启延迟统计 */
+static inline void _stat_alloc(mempool_t *pool, const void *mem, uint64_t begin)
+{
+    _mpstat_t *stat = _stat_shard(pool);
+    _stat_add((NULL != mem) ? &stat->alloc : &stat->fail, 1);
+    if (0 == begin)
+    {
+        return;
+    }
+
+    uint64_t slot = (stimer_getnanosec() - begin) >> 6;
+    int idx = (0 == slot) ? 0 : (64 - __builtin_clzl(slot));
+    if (idx >= MP_HIST_BUCKETS)
+    {
+        idx = MP_HIST_BUCKETS - 1;
+    }
+
+    _stat_add(&stat->hist[idx], 1);
+}
+
+static inline uint64_t _stat_begin(mempool_t *pool)
+{
+    return atomic_bool_fetch(&pool->stat.enable) ? stimer_getnanosec() : 0;
+}
+
+/*************************************************************************
+*************************************************************************/
+
+static inline void _mempool_destroy_bitmap(mempool_t *pool)
+{
+    for (int i = 0; i < pool->b_cnt; i++)
+    {
+        bitmap_destroy(pool->b_map[i]);
+        pool->b_map[i] = NULL;
+    }
+}
+
+/* 单元序号与地址的转换，着色模式下需先定位分段 */
+static inline char *_mempool_addr(mempool_t *pool, uint32_t pos)
+{
+    if (0 == pool->m_seg)
+    {
+        return pool->mem + (uint64_t)pool->fix_size * pos;
+    }
+
+    uint32_t seg = pos / (uint32_t)pool->b_avg;
+    seg = (seg >= pool->m_segs) ? pool->m_segs - 1 : seg;
+    return pool->mem + pool->m_seg * seg + (uint64_t)(seg % pool->m_color) * pool->m_unit
+            + (uint64_t)pool->fix_size * (pos - seg * (uint32_t)pool->b_avg);
+}
+
+static inline uint32_t _mempool_pos(mempool_t *pool, const void *mem)
+{
+    uint64_t off = (uint64_t)((const char *)mem - pool->mem);
+    if (0 == pool->m_seg)
+    {
+        return (uint32_t)(off / pool->fix_size);
+    }
+
+    uint64_t seg = off / pool->m_seg;
+    seg = (seg >= pool->m_segs) ? pool->m_segs - 1 : seg;
+    off -= pool->m_seg * seg + (seg % pool->m_color) * pool->m_unit;
+    return (uint32_t)(seg * (uint32_t)pool->b_avg + off / pool->fix_size);
+}
+
+/*
+ * 空闲链表引擎：空闲单元的前4字节保存下一个空闲单元的序号+1，
+ * 链表头带版本号，通过64位CAS实现无锁栈，避免ABA问题。
+ * 弹出时读取的next可能已被其他线程取走并改写，此时版本号已变化，CAS必然失败。
+ */
+
+static inline uint32_t *_freelist_next(mempool_t *pool, uint32_t idx)
+{
+    return (uint32_t *)(void *)_mempool_addr(pool, idx);
+}
+
+static inline void *_freelist_pop(mempool_t *pool)
+{
+    uint64_t head = atomic_u64_fetch(&pool->f_head);
+    uint32_t idx = 0;
+    for (;;)
+    {
+        idx = (uint32_t)head;
+        if (0 == idx)
+        {
+            return NULL;
+        }
+
+        uint32_t next = __atomic_load_n(_freelist_next(pool, idx - 1), __ATOMIC_RELAXED);
+        uint64_t nw = (((head >> 32) + 1) << 32) | next;
+        if (atomic_u64_cas(&pool->f_head, head, nw, &head))
+        {
+            break;
+        }
+
+        _stat_add(&_stat_shard(pool)->contended, 1);
+    }
+
+    (void)atomic_u32_inc(&pool->used);
+    return _mempool_addr(pool, idx - 1);
+}
+
+static inline void _freelist_push(mempool_t *pool, uint32_t idx)
+{
+    uint32_t *next = _freelist_next(pool, idx);
+    uint64_t head = atomic_u64_fetch(&pool->f_head);
+    for (;;)
+    {
+        __atomic_store_n(next, (uint32_t)head, __ATOMIC_RELAXED);
+        if (atomic_u64_cas(&pool->f_head, head, (((head >> 32) + 1) << 32) | (idx + 1), &head))
+        {
+            break;
+        }
+
+        _stat_add(&_stat_shard(pool)->contended, 1);
+    }
+}
+
+/* 调试模式在接口层记录单元是否在使用者手中，线程缓存中的单元视为空闲 */
+static inline void _debug_alloc(mempool_t *pool, const void *mem)
+{
+    if ((NULL != pool->f_state) && (NULL != mem))
+    {
+        __atomic_store_n(&pool->f_state[_mempool_pos(pool, mem)], 1, __ATOMIC_RELAXED);
+    }
+}
+
+static inline void _debug_free(mempool_t *pool, const void *mem)
+{
+    if ((NULL != pool->f_state)
+        && (1 != __atomic_exchange_n(&pool->f_state[_mempool_pos(pool, mem)], 0, __ATOMIC_RELAXED)))
+    {
+        log_error("mempool: double-free");
+        abort();
+    }
+}
+
+/*************************************************************************
+*************************************************************************/
+
+/* 已启用分段全部用尽时启用下一个分段，分段数有变化时返回true以便重试 */
+static bool _chunk_grow(mempool_t *pool, int act)
+{
+    bool changed = true;
+
+    spinlock_lock(&pool->c_lock);
+    if (pool->c_act == act)
+    {
+        if (act < pool->b_cnt)
+        {
+            atomic_s32_store(&pool->c_act, act + 1);
+        }
+        else
+        {
+            changed = false;
+        }
+    }
+    spinlock_unlock(&pool->c_lock);
+
+    return changed;
+}
+
+/*
+ * 尝试归还末尾分段：调用前已停止在该分段分配，再占满其位图确认无人持有，
+ * 此时才能安全地丢弃物理页；之前读到旧c_act的申请者之后再分配只会重新缺页得到零页。
+ * 不持有c_lock执行，由c_shrink保证c_seal只有一个使用者。
+ */
+static bool _chunk_release(mempool_t *pool, int idx)
+{
+    _chunk_t *chunk = &pool->c_info[idx];
+    bitmap_t *bmap = pool->b_map[idx];
+
+    int count = 0;
+    while ((uint32_t)count < chunk->bits)
+    {
+        int want = (int)chunk->bits - count;
+        int got = bitmap_allocbits(bmap, pool->c_seal + count, (want < BULK_BATCH) ? want : BULK_BATCH);
+        if (0 == got)
+        {
+            break;
+        }
+
+        count += got;
+    }
+
+    bool empty = ((uint32_t)count == chunk->bits);
+    if (empty)
+    {
+        char *start = _mempool_addr(pool, (uint32_t)(idx * pool->b_avg));
+        uint64_t len = (uint64_t)pool->fix_size * chunk->bits;
+
+        /* madvise按页处理，只丢弃完全位于分段内的页 */
+        uintptr_t page = (uintptr_t)pool->m_page;
+        uintptr_t head = ((uintptr_t)start + page - 1) & ~(page - 1);
+        uintptr_t tail = ((uintptr_t)start + len) & ~(page - 1);
+        if ((tail > head) && (0 != madvise((void *)head, tail - head, MADV_DONTNEED)))
+        {
+            log_warn("mempool: madvise chunk %d failed, err=%s", idx, strerror(errno));
+        }
+    }
+
+    (void)bitmap_freebits(bmap, pool->c_seal, count);
+    return empty;
+}
+
+/* 从末尾开始归还空闲超过冷却时间的分段，至少保留一个分段；
+ * c_lock只保护分段选择和c_act的修改，占满位图和madvise在锁外执行 */
+static void _chunk_shrink(mempool_t *pool, uint64_t now)
+{
+    spinlock_lock(&pool->c_lock);
+    pool->c_check = now;
+    if (pool->c_shrink)
+    {
+        spinlock_unlock(&pool->c_lock);
+        return;
+    }
+
+    pool->c_shrink = true;
+    while (pool->c_act > 1)
+    {
+        int idx = pool->c_act - 1;
+        uint64_t idle = atomic_u64_fetch(&pool->c_info[idx].idle);
+        if ((0 != atomic_u32_fetch(&pool->c_info[idx].used))
+            || (0 == idle) || (now - idle < SHRINK_DELAY))
+        {
+            break;
+        }
+
+        atomic_s32_store(&pool->c_act, idx);
+        spinlock_unlock(&pool->c_lock);
+
+        bool released = _chunk_release(pool, idx);
+
+        spinlock_lock(&pool->c_lock);
+        if (!released)
+        {
+            /* 期间已有扩展时不需恢复 */
+            if (pool->c_act == idx)
+            {
+                atomic_s32_store(&pool->c_act, idx + 1);
+            }
+
+            break;
+        }
+    }
+
+    pool->c_shrink = false;
+    spinlock_unlock(&pool->c_lock);
+}
+
+/*************************************************************************
+*************************************************************************/
+
+static int g_numa_nodes = 1;
+static uint8_t g_numa_id[MAX_NODES];            /* 分区号到节点号的映射，节点号可能不连续 */
+static uint8_t g_numa_cpu[MAX_NODE_CPUS];       /* cpu到分区号的映射 */
+static pthread_once_t g_numa_once = PTHREAD_ONCE_INIT;
+
+/* 解析形如"0-3,8-11"的列表，将列出的map[i]置为val */
+static void _numa_parse_list(const char *list, uint8_t *map, long size, uint8_t val)
+{
+    const char *p = list;
+    while ('\0' != *p)
+    {
+        char *end = NULL;
+        long first = strtol(p, &end, 10);
+        if (end == p)
+        {
+            break;
+        }
+
+        long last = first;
+        if ('-' == *end)
+        {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+        }
+
+        for (long i = first; (i <= last) && (i < size); i++)
+        {
+            map[i] = val;
+        }
+
+        p = (',' == *end) ? end + 1 : end;
+        if (('\n' == *p) || ('\0' == *p))
+        {
+            break;
+        }
+    }
+}
+
+static bool _numa_read(const char *path, char *buff, int size)
+{
+    FILE *fp = fopen(path, "r");
+    if (NULL == fp)
+    {
+        return false;
+    }
+
+    bool ok = (NULL != fgets(buff, size, fp));
+    (void)fclose(fp);
+    return ok;
+}
+
+/* 在线节点由node/online给出，节点号可能不连续(如"0,2")，按顺序编为分区0,1... */
+static void _numa_init(void)
+{
+    char path[64];
+    char buff[1024];
+    uint8_t online[MAX_NODES] = {0};
+    if (!_numa_read("/sys/devices/system/node/online", buff, sizeof(buff)))
+    {
+        return;
+    }
+
+    _numa_parse_list(buff, online, MAX_NODES, 1);
+
+    int part = 0;
+    for (int node = 0; node < MAX_NODES; node++)
+    {
+        if (!online[node])
+        {
+            continue;
+        }
+
+        (void)snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        if (_numa_read(path, buff, sizeof(buff)))
+        {
+            _numa_parse_list(buff, g_numa_cpu, MAX_NODE_CPUS, (uint8_t)part);
+        }
+
+        g_numa_id[part++] = (uint8_t)node;
+    }
+
+    g_numa_nodes = (0 == part) ? 1 : part;
+}
+
+static inline int _numa_node(void)
+{
+    int cpu = sched_getcpu();
+    return ((cpu < 0) || (cpu >= MAX_NODE_CPUS)) ? 0 : g_numa_cpu[cpu];
+}
+
+/* 将每个分区的内存绑定到对应节点，分区边界只按整页绑定 */
+static void _numa_bind(mempool_t *pool)
+{
+    uintptr_t page = (uintptr_t)pool->m_page;
+    uint32_t slots = (uint32_t)(pool->n_map * pool->b_avg);
+    for (int part = 0; part < pool->n_cnt; part++)
+    {
+        char *start = _mempool_addr(pool, slots * (uint32_t)part);
+        char *end = (part == pool->n_cnt - 1) ? pool->mem + pool->m_span
+                                                : _mempool_addr(pool, slots * (uint32_t)(part + 1));
+
+        uintptr_t head = ((uintptr_t)start + page - 1) & ~(page - 1);
+        uintptr_t tail = (uintptr_t)end & ~(page - 1);
+        if (tail <= head)
+        {
+            continue;
+        }
+
+        unsigned long mask = 1UL << g_numa_id[part];
+        if (0 != syscall(SYS_mbind, head, tail - head, NUMA_PREFERRED, &mask, MAX_NODES + 1, 0))
+        {
+            log_warn("mempool: mbind node %d failed, err=%s", g_numa_id[part], strerror(errno));
+        }
+    }
+}
+
+/*************************************************************************
+*************************************************************************/
+
+/* 可增长模式下不加锁读取计数，跳过已满的分段 */
+static inline bool _chunk_full(mempool_t *pool, int idx)
+{
+    return (pool->flags & MEMPOOL_GROWABLE)
+        && (atomic_u32_fetch(&pool->c_info[idx].used) >= pool->c_info[idx].bits);
+}
+
+/*
+ * 可增长模式的起始分段：在最低的GROW_SPREAD个未满分段中轮询，
+ * 使分配集中在前部而末尾分段能够空闲下来被归还，同时不会都竞争同一个位图锁
+ */
+static inline uint64_t _chunk_start(mempool_t *pool, int act, uint64_t val)
+{
+    int first = 0;
+    while ((first < act - 1) && _chunk_full(pool, first))
+    {
+        first++;
+    }
+
+    int spread = act - first;
+    spread = (spread > GROW_SPREAD) ? GROW_SPREAD : spread;
+    return (uint64_t)first + val % (uint64_t)(uint32_t)spread;
+}
+
+/* 在[first, first + num)范围的位图中轮询申请 */
+static inline void *_mempool_getbit(mempool_t *pool, int first, int num, uint64_t val)
+{
+    int _idx = first + (int)(val % (uint64_t)(uint32_t)num);
+    int _bit = -1;
+    for (int i = 0; i < num; i++)
+    {
+        if (!_chunk_full(pool, _idx) && (BIT_OK == bitmap_allocbit(pool->b_map[_idx], &_bit)))
+        {
+            int pos = _idx * pool->b_avg + _bit;
+            (void)atomic_u32_inc(&pool->used);
+            if ((pool->flags & MEMPOOL_GROWABLE)
+                && (1 == atomic_u32_inc(&pool->c_info[_idx].used)))
+            {
+                atomic_u64_store(&pool->c_info[_idx].idle, 0);
+            }
+
+            return _mempool_addr(pool, (uint32_t)pos);
+        }
+
+        if (++_idx == first + num)
+        {
+            _idx = first;
+        }
+    }
+
+    return NULL;
+}
+
+/* 在[first, first + num)范围的位图中批量申请，每个位图一次加锁 */
+static uint32_t _mempool_getbits(mempool_t *pool, int first, int num, uint64_t val,
+                                    void **out, uint32_t n)
+{
+    int _idx = first + (int)(val % (uint64_t)(uint32_t)num);
+    int bits[BULK_BATCH];
+    uint32_t got = 0;
+    for (int i = 0; (i < num) && (got < n); )
+    {
+        int want = (n - got < BULK_BATCH) ? (int)(n - got) : BULK_BATCH;
+        int count = _chunk_full(pool, _idx) ? 0 : bitmap_allocbits(pool->b_map[_idx], bits, want);
+        for (int j = 0; j < count; j++)
+        {
+            out[got++] = _mempool_addr(pool, (uint32_t)(_idx * pool->b_avg + bits[j]));
+        }
+
+        if ((0 != count) && (pool->flags & MEMPOOL_GROWABLE)
+            && ((uint32_t)count == atomic_u32_add(&pool->c_info[_idx].used, (uint32_t)count)))
+        {
+            atomic_u64_store(&pool->c_info[_idx].idle, 0);
+        }
+
+        /* 当前位图已申请完才换下一个 */
+        if (count < want)
+        {
+            i++;
+            if (++_idx == first + num)
+            {
+                _idx = first;
+            }
+        }
+    }
+
+    (void)atomic_u32_add(&pool->used, got);
+    return got;
+}
+
+static uint32_t _mempool_malloc_bulk(mempool_t *pool, void **out, uint32_t n)
+{
+    uint32_t got = 0;
+    if (pool->flags & MEMPOOL_FREELIST)
+    {
+        while (got < n)
+        {
+            out[got] = _freelist_pop(pool);
+            if (NULL == out[got])
+            {
+                break;
+            }
+
+            got++;
+        }
+
+        return got;
+    }
+
+    uint64_t val = atomic_u64_inc(&pool->b_idx);
+    if (pool->flags & MEMPOOL_NUMA)
+    {
+        int node = _numa_node() % pool->n_cnt;
+        for (int i = 0; (i < pool->n_cnt) && (got < n); i++)
+        {
+            int part = (node + i) % pool->n_cnt;
+            got += _mempool_getbits(pool, part * pool->n_map, pool->n_map, val, out + got, n - got);
+        }
+
+        return got;
+    }
+
+    for (;;)
+    {
+        int act = (pool->flags & MEMPOOL_GROWABLE) ? atomic_s32_fetch(&pool->c_act) : pool->b_cnt;
+        uint64_t start = (pool->flags & MEMPOOL_GROWABLE) ? _chunk_start(pool, act, val) : val;
+        got += _mempool_getbits(pool, 0, act, start, out + got, n - got);
+        if ((got == n) || !(pool->flags & MEMPOOL_GROWABLE) || !_chunk_grow(pool, act))
+        {
+            return got;
+        }
+    }
+}
+
+static inline void *_mempool_malloc(mempool_t *pool)
+{
+    if (pool->flags & MEMPOOL_FREELIST)
+    {
+        return _freelist_pop(pool);
+    }
+
+    uint64_t val = atomic_u64_inc(&pool->b_idx);
+
+    /* NUMA模式先在本节点分区申请，失败后依次尝试其他节点 */
+    if (pool->flags & MEMPOOL_NUMA)
+    {
+        int node = _numa_node() % pool->n_cnt;
+        for (int i = 0; i < pool->n_cnt; i++)
+        {
+            int part = (node + i) % pool->n_cnt;
+            void *mem = _mempool_getbit(pool, part * pool->n_map, pool->n_map, val);
+            if (NULL != mem)
+            {
+                return mem;
+            }
+        }
+
+        return NULL;
+    }
+
+    for (;;)
+    {
+        /* 可增长模式下只在已启用的分段中分配 */
+        int act = (pool->flags & MEMPOOL_GROWABLE) ? atomic_s32_fetch(&pool->c_act) : pool->b_cnt;
+        uint64_t start = (pool->flags & MEMPOOL_GROWABLE) ? _chunk_start(pool, act, val) : val;
+        void *mem = _mempool_getbit(pool, 0, act, start);
+        if (NULL != mem)
+        {
+            return mem;
+        }
+
+        if (!(pool->flags & MEMPOOL_GROWABLE) || !_chunk_grow(pool, act))
+        {
+            return NULL;
+        }
+    }
+}
+
+static void _mempool_wakeup(mempool_t *pool)
+{
+    list_head_t ready;
+    list_init(&ready);
+
+    /* 在等待锁内重新申请并交付，与申请者登记后的重试互斥，不会丢失唤醒 */
+    spinlock_lock(&pool->wait.lock);
+    while (!list_empty(&pool->wait.head))
+    {
+        void *mem = _mempool_malloc(pool);
+        if (NULL == mem)
+        {
+            break;
+        }
+
+        _mempool_waiter_t *waiter = list_first_entry(&pool->wait.head, _mempool_waiter_t, link);
+        list_del(&waiter->link);
+        (void)atomic_u32_dec(&pool->wait.count);
+        waiter->mem = mem;
+        list_add_tail(&waiter->link, &ready);
+    }
+    spinlock_unlock(&pool->wait.lock);
+
+    /* up之后等待者可能立即返回并释放自身，需先取出下一个 */
+    list_head_t *pos, *next;
+    list_foreach_safe(pos, next, &ready)
+    {
+        _mempool_waiter_t *waiter = container_of(pos, _mempool_waiter_t, link);
+        sema_up(waiter->sem);
+    }
+}
+
+static void *_mempool_wait(mempool_t *pool)
+{
+    _mempool_waiter_t *waiter = (_mempool_waiter_t *)malloc(sizeof(_mempool_waiter_t));
+    if (NULL == waiter)
+    {
+        log_error("mempool: malloc waiter failed");
+        return NULL;
+    }
+
+    waiter->mem = NULL;
+    sema_init(waiter->sem);
+    _stat_add(&_stat_shard(pool)->wait, 1);
+
+    /* 1. 先登记再重试，与释放者的计数检查配合避免错过释放 */
+    spinlock_lock(&pool->wait.lock);
+    list_add_tail(&waiter->link, &pool->wait.head);
+    (void)atomic_u32_inc(&pool->wait.count);
+    void *mem = _mempool_malloc(pool);
+    if (NULL != mem)
+    {
+        list_del(&waiter->link);
+        (void)atomic_u32_dec(&pool->wait.count);
+    }
+    spinlock_unlock(&pool->wait.lock);
+
+    /* 2. 等待释放者交付，超时后若已被交付则仍需消耗对应的up */
+    if ((NULL == mem) && (0 != sema_timeddown(waiter->sem, MAX_WAIT)))
+    {
+        spinlock_lock(&pool->wait.lock);
+        bool handed = (NULL != waiter->mem);
+        if (!handed)
+        {
+            list_del(&waiter->link);
+            (void)atomic_u32_dec(&pool->wait.count);
+        }
+        spinlock_unlock(&pool->wait.lock);
+
+        if (!handed)
+        {
+            _stat_add(&_stat_shard(pool)->timeout, 1);
+        }
+
+        if (handed)
+        {
+            sema_down(waiter->sem);
+        }
+    }
+
+    if (NULL == mem)
+    {
+        mem = waiter->mem;
+    }
+
+    sema_fini(waiter->sem);
+    free(waiter);
+    return mem;
+}
+
+static inline bool _mempool_owned(mempool_t *pool, const void *mem)
+{
+    const char *ptr = (const char *)mem;
+    return (ptr >= pool->mem)
+        && (ptr < pool->mem + pool->m_span);
+}
+
+static inline void _mempool_freebit(mempool_t *pool, int bit)
+{
+    /* 计算位图位置 */
+    int idx = bit / pool->b_avg;
+    bit %= pool->b_avg;
+    if (idx > pool->b_cnt - 1)
+    {
+        idx = pool->b_cnt - 1;
+        bit += pool->b_avg;
+    }
+
+    if (0 != bitmap_freebit(pool->b_map[idx], bit))
+    {
+        log_error("mempool: may be double-free");
+        abort();
+    }
+
+    /* 分段变空时记录时间，并顺带检查是否有可归还的分段 */
+    if ((pool->flags & MEMPOOL_GROWABLE)
+        && (0 == atomic_u32_dec(&pool->c_info[idx].used)))
+    {
+        uint64_t now = stimer_getnanosec();
+        atomic_u64_store(&pool->c_info[idx].idle, now);
+        if (now - atomic_u64_fetch(&pool->c_check) >= SHRINK_DELAY)
+        {
+            _chunk_shrink(pool, now);
+        }
+    }
+}
+
+static void _mempool_release(mempool_t *pool, void *mem)
+{
+    /* 计算内存块所在的位置 */
+    int bit = (int)_mempool_pos(pool, mem);
+    if (pool->flags & MEMPOOL_FREELIST)
+    {
+        _freelist_push(pool, (uint32_t)bit);
+    }
+    else
+    {
+        _mempool_freebit(pool, bit);
+    }
+
+    (void)atomic_u32_dec(&pool->used);
+
+    /* used的原子操作保证释放位图后再检查等待者 */
+    if (0 != atomic_u32_fetch(&pool->wait.count))
+    {
+        _mempool_wakeup(pool);
+    }
+}
+
+/* 连续属于同一位图的单元合并为一次批量释放 */
+static void _mempool_release_bulk(mempool_t *pool, void **ptrs, uint32_t n)
+{
+    int bits[BULK_BATCH];
+    int count = 0;
+    int last = -1;
+    uint32_t done = 0;
+    for (uint32_t i = 0; i <= n; i++)
+    {
+        int idx = -1;
+        int bit = 0;
+        if (i < n)
+        {
+            bit = (int)_mempool_pos(pool, ptrs[i]);
+            idx = bit / pool->b_avg;
+            bit %= pool->b_avg;
+            if (idx > pool->b_cnt - 1)
+            {
+                idx = pool->b_cnt - 1;
+                bit += pool->b_avg;
+            }
+        }
+
+        if ((0 != count) && ((idx != last) || (BULK_BATCH == count)))
+        {
+            if (0 != bitmap_freebits(pool->b_map[last], bits, count))
+            {
+                log_error("mempool: may be double-free");
+                abort();
+            }
+
+            done += (uint32_t)count;
+            if ((pool->flags & MEMPOOL_GROWABLE)
+                && (0 == atomic_u32_sub(&pool->c_info[last].used, (uint32_t)count)))
+            {
+                uint64_t now = stimer_getnanosec();
+                atomic_u64_store(&pool->c_info[last].idle, now);
+                if (now - atomic_u64_fetch(&pool->c_check) >= SHRINK_DELAY)
+                {
+                    _chunk_shrink(pool, now);
+                }
+            }
+
+            count = 0;
+        }
+
+        if (i == n)
+        {
+            break;
+        }
+
+        bits[count++] = bit;
+        last = idx;
+    }
+
+    (void)atomic_u32_sub(&pool->used, done);
+    if (0 != atomic_u32_fetch(&pool->wait.count))
+    {
+        _mempool_wakeup(pool);
+    }
+}
+
+/*************************************************************************
+*************************************************************************/
+
+/* 归还最早放入的count个单元，保留栈顶仍在cache中的单元 */
+static void _magazine_flush(_magazine_t *mag, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        _mempool_release(mag->pool, mag->slot[i]);
+    }
+
+    mag->count -= count;
+    (void)memmove(mag->slot, mag->slot + count, mag->count * sizeof(void *));
+}
+
+static void _magazine_exit(void *args)
+{
+    _magazine_t *mag = (_magazine_t *)args;
+    mempool_t *pool = mag->pool;
+
+    _magazine_flush(mag, mag->count);
+
+    spinlock_lock(&pool->mag.lock);
+    list_del(&mag->link);
+    spinlock_unlock(&pool->mag.lock);
+    free(mag);
+}
+
+static _magazine_t *_magazine_get(mempool_t *pool)
+{
+    _magazine_t *mag = (_magazine_t *)pthread_getspecific(pool->mag.key);
+    if (NULL != mag)
+    {
+        return mag;
+    }
+
+    /* 失败时退化为直接访问位图 */
+    mag = (_magazine_t *)malloc(sizeof(_magazine_t));
+    if (NULL == mag)
+    {
+        return NULL;
+    }
+
+    mag->pool = pool;
+    mag->count = 0;
+    if (0 != pthread_setspecific(pool->mag.key, mag))
+    {
+        free(mag);
+        return NULL;
+    }
+
+    spinlock_lock(&pool->mag.lock);
+    list_add_tail(&mag->link, &pool->mag.head);
+    spinlock_unlock(&pool->mag.lock);
+    return mag;
+}
+
+static inline void *_magazine_alloc(mempool_t *pool)
+{
+    _magazine_t *mag = _magazine_get(pool);
+    if (NULL == mag)
+    {
+        return _mempool_malloc(pool);
+    }
+
+    /* 缓存为空时才从位图补充一批 */
+    if (0 == mag->count)
+    {
+        mag->count = _mempool_malloc_bulk(pool, mag->slot, pool->mag.batch);
+    }
+
+    return (0 != mag->count) ? mag->slot[--(mag->count)] : NULL;
+}
+
+static void _magazine_destroy(mempool_t *pool)
+{
+    /* 线程缓存中的单元随内存池一起释放 */
+    (void)pthread_key_delete(pool->mag.key);
+
+    list_head_t *pos, *next;
+    list_foreach_safe(pos, next, &pool->mag.head)
+    {
+        list_del(pos);
+        free(container_of(pos, _magazine_t, link));
+    }
+
+    spinlock_destroy(&pool->mag.lock);
+}
+
 /*************************************************************************
 *************************************************************************/
 
-static inline void _mempool_destroy_bitmap(mempool_t *pool)
-{
-    for (int i = 0; i < pool->b_cnt; i++)
+/* 映射一段按align对齐的匿名内存，多映射的头尾部分直接解除 */
+static void *_mempool_mmap_aligned(size_t len, size_t align, int flags)
+{
+    char *map = (char *)mmap(NULL, len + align, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+    if (MAP_FAILED == (void *)map)
+    {
+        return NULL;
+    }
+
+    char *start = (char *)(((uintptr_t)map + align - 1) & ~(uintptr_t)(align - 1));
+    if (start != map)
     {
-        bitmap_destroy(pool->b_map[i]);
-        pool->b_map[i] = NULL;
+        (void)munmap(map, (size_t)(start - map));
+    }
+
+    size_t tail = (size_t)(map + len + align - (start + len));
+    if (0 != tail)
+    {
+        (void)munmap(start + len, tail);
     }
+
+    return start;
 }
 
-static inline void *_mempool_malloc(mempool_t *pool)
+/*
+ * 映射单元内存：大页模式优先使用hugetlbfs大页，失败时退化为透明大页(MADV_HUGEPAGE)，
+ * 都不可用时使用普通页。
+ */
+static bool _mempool_map(mempool_t *pool, size_t len)
 {
-    uint64_t val = atomic_u64_inc(&pool->b_idx);
-    int _idx = (int)(val % (uint64_t)(uint32_t)pool->b_cnt);
-    int _bit = -1;
-    for (int i = 0; i < pool->b_cnt; i++)
+    int extra = (pool->flags & MEMPOOL_GROWABLE) ? MAP_NORESERVE : 0;
+    char *map = NULL;
+
+    pool->m_page = (size_t)sysconf(_SC_PAGESIZE);
+    pool->m_back = MEMPOOL_BACK_MMAP;
+    if (pool->flags & MEMPOOL_HUGEPAGE)
     {
-        if (BIT_OK == bitmap_allocbit(pool->b_map[_idx], &_bit))
+        /* hugetlb不能带MAP_NORESERVE，否则大页不足时访问会SIGBUS */
+        size_t hlen = (len + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+        map = (char *)mmap(NULL, hlen, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (MAP_FAILED != (void *)map)
         {
-            int pos = _idx * pool->b_avg + _bit;
-            (void)atomic_u32_inc(&pool->used);
-
-            return pool->mem + (uint64_t)pool->fix_size * (uint32_t)pos;
+            len = hlen;
+            pool->m_page = HUGE_PAGE;
+            pool->m_back = MEMPOOL_BACK_HUGETLB;
+        }
+        else
+        {
+            log_info("mempool: MAP_HUGETLB %zu failed(%s), fallback to THP", hlen, strerror(errno));
+            map = (char *)_mempool_mmap_aligned(len, HUGE_PAGE, extra);
+            if ((NULL != map) && (0 == madvise(map, len, MADV_HUGEPAGE)))
+            {
+                pool->m_back = MEMPOOL_BACK_THP;
+            }
         }
+    }
+    else
+    {
+        map = (char *)mmap(NULL, len, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | extra, -1, 0);
+        map = (MAP_FAILED == (void *)map) ? NULL : map;
+    }
 
-        _idx++;
-        _idx %= pool->b_cnt;
+    if (NULL == map)
+    {
+        log_error("mempool: mmap %zu failed, err=%s", len, strerror(errno));
+        return false;
     }
 
-    return NULL;
+    pool->mem = map;
+    pool->m_len = len;
+    return true;
+}
+
+/* 逐页写入以提前完成缺页，NUMA模式下需在绑定节点之后执行 */
+static void _mempool_prefault(mempool_t *pool)
+{
+    for (size_t off = 0; off < pool->m_len; off += pool->m_page)
+    {
+        ((volatile char *)pool->mem)[off] = 0;
+    }
 }
 
 /*************************************************************************
 *************************************************************************/
 
-mempool_t *mempool_create(uint32_t size, uint32_t count, void *ptr)
+mempool_t *mempool_create_ex(uint32_t size, uint32_t count, void *ptr, uint32_t flags)
 {
     if (0 == count)
     {
@@ -89,6 +1119,13 @@ mempool_t *mempool_create(uint32_t size, uint32_t count, void *ptr)
     }
 
     uint32_t b_cnt = (uint32_t)cpu * 5 / 4;
+
+    /* 可增长模式下位图即分段，分段数按最大值取，使每次扩展/收缩的粒度足够小 */
+    if (flags & MEMPOOL_GROWABLE)
+    {
+        b_cnt = MAX_CPUS;
+    }
+
     if (b_cnt > MAX_CPUS)
     {
         b_cnt = MAX_CPUS;
@@ -103,6 +1140,34 @@ mempool_t *mempool_create(uint32_t size, uint32_t count, void *ptr)
         }
     }
 
+    /* NUMA模式下位图数为节点数的整数倍，每个节点一个分区 */
+    uint32_t n_cnt = 1;
+    if (flags & MEMPOOL_NUMA)
+    {
+        if (ptr || (flags & (MEMPOOL_GROWABLE | MEMPOOL_FREELIST)))
+        {
+            log_error("mempool: numa pool conflicts with ptr, growable or freelist");
+            return NULL;
+        }
+
+        (void)pthread_once(&g_numa_once, _numa_init);
+        n_cnt = (uint32_t)g_numa_nodes;
+        n_cnt = (n_cnt > count) ? count : n_cnt;
+
+        uint32_t n_map = (b_cnt + n_cnt - 1) / n_cnt;
+        if (n_map * n_cnt > MAX_CPUS)
+        {
+            n_map = MAX_CPUS / n_cnt;
+        }
+
+        if (n_map * n_cnt > count)
+        {
+            n_map = 1;
+        }
+
+        b_cnt = n_map * n_cnt;
+    }
+
     /* 计算每个位图的bit数，如果不能均分，最后一个位图的bit数将变多 */
     uint32_t bits_in_map[MAX_CPUS] = {0};
     uint32_t average = count / b_cnt;
@@ -116,11 +1181,99 @@ mempool_t *mempool_create(uint32_t size, uint32_t count, void *ptr)
         bits_in_map[b_cnt - 1] += (count - b_cnt * average);
     }
 
-    /* 分配内存空间 */
+    /* 空闲链表引擎不需要位图，但单元需容纳链表序号 */
+    if (flags & MEMPOOL_FREELIST)
+    {
+        if (size < sizeof(uint32_t))
+        {
+            log_error("mempool: size %u too small for freelist", size);
+            return NULL;
+        }
+
+        b_cnt = 0;
+    }
+
+    /* 可增长、大页和预取模式需要自行映射内存 */
+    bool mapped = (flags & (MEMPOOL_GROWABLE | MEMPOOL_HUGEPAGE | MEMPOOL_PREFAULT | MEMPOOL_NUMA)) ? true : false;
+    if (mapped && ptr)
+    {
+        log_error("mempool: growable/hugepage/prefault pool conflicts with ptr");
+        return NULL;
+    }
+
+    if ((flags & MEMPOOL_GROWABLE) && (flags & MEMPOOL_FREELIST))
+    {
+        log_error("mempool: growable pool conflicts with freelist");
+        return NULL;
+    }
+
+    /* 单元跨度按对齐值取整，调用者传入的内存按原始大小计算，因此不能同时使用 */
+    uint32_t shift = flags >> MEMPOOL_ALIGN_SHIFT;
+    if (((0 != shift) || (flags & MEMPOOL_COLOR)) && ptr)
+    {
+        log_error("mempool: align/color pool conflicts with ptr");
+        return NULL;
+    }
+
+    if ((flags & MEMPOOL_COLOR) && (flags & MEMPOOL_FREELIST))
+    {
+        log_error("mempool: color pool conflicts with freelist");
+        return NULL;
+    }
+
+    if (shift >= 32)
+    {
+        log_error("mempool: invalid align, must be MEMPOOL_ALIGN(power of two)");
+        return NULL;
+    }
+
+    if ((1UL << shift) > (unsigned long)sysconf(_SC_PAGESIZE))
+    {
+        log_error("mempool: align 2^%u exceeds page size", shift);
+        return NULL;
+    }
+
+    uint32_t align = 1U << shift;
+
+    uint64_t stride = ((uint64_t)size + align - 1) & ~(uint64_t)(align - 1);
+    if (stride > UINT32_MAX)
+    {
+        log_error("mempool: size %u too large for align %u", size, align);
+        return NULL;
+    }
+
+    /* 着色：分段i的起始偏移(i % colors)个unit，偏移不超过一个单元跨度；
+     * 分段跨度取为单元跨度的整数倍，以免分段间的填充抵消着色偏移 */
+    uint32_t unit = (align > CACHELINE_SIZE) ? align : CACHELINE_SIZE;
+    uint32_t colors = (flags & MEMPOOL_COLOR) ? (uint32_t)(stride / unit) : 0;
+    colors = (colors > b_cnt) ? b_cnt : colors;
+
+    uint64_t seg = 0;
+    uint64_t span = stride * count;
+    if (1 < colors)
+    {
+        seg = (stride * average + (uint64_t)(colors - 1) * unit + stride - 1) / stride * stride;
+        span = seg * (b_cnt - 1) + (uint64_t)((b_cnt - 1) % colors) * unit
+                + stride * bits_in_map[b_cnt - 1];
+    }
+
+    /* 分配内存空间，可增长模式另需收缩时占满最大分段(最后一个)的位序号数组 */
     size_t m_size = sizeof(mempool_t) + b_cnt * sizeof(bitmap_t *);
-    if (!ptr)
+    size_t max_bits = 0;
+    if (flags & MEMPOOL_GROWABLE)
+    {
+        max_bits = bits_in_map[b_cnt - 1];
+        m_size += b_cnt * sizeof(_chunk_t) + max_bits * sizeof(int);
+    }
+
+    if (!ptr && !mapped)
     {
-        m_size += (uint64_t)size * count;
+        m_size += span + align - 1;
+    }
+
+    if (flags & MEMPOOL_DEBUG)
+    {
+        m_size += count;
     }
     char *mem = (char *)malloc(m_size);
     if (NULL == mem)
@@ -133,7 +1286,10 @@ mempool_t *mempool_create(uint32_t size, uint32_t count, void *ptr)
     mempool_t *pool = (mempool_t *)mem;
     mem += sizeof(mempool_t);
 
-    pool->fix_size = size;
+    pool->name[0] = '\0';
+
+    pool->fix_size = (uint32_t)stride;
+    pool->flags = flags;
     pool->max = count;
     pool->used = 0;
     pool->b_idx = 0;
@@ -142,27 +1298,156 @@ mempool_t *mempool_create(uint32_t size, uint32_t count, void *ptr)
     pool->b_map = (bitmap_t **)(void *)(mem);
     mem += (b_cnt * sizeof(void *));
 
-    pool->mem = !ptr ? mem : (char *)ptr;
+    /* 初始只启用第一个分段 */
+    pool->c_act = (int)b_cnt;
+    pool->c_check = 0;
+    pool->c_shrink = false;
+    pool->c_info = NULL;
+    pool->c_seal = NULL;
+    spinlock_init(&pool->c_lock);
+    if (flags & MEMPOOL_GROWABLE)
+    {
+        pool->c_act = 1;
+        pool->c_info = (_chunk_t *)(void *)mem;
+        mem += (b_cnt * sizeof(_chunk_t));
+        for (uint32_t i = 0; i < b_cnt; i++)
+        {
+            pool->c_info[i].bits = bits_in_map[i];
+            pool->c_info[i].used = 0;
+            pool->c_info[i].idle = 0;
+        }
+
+        pool->c_seal = (int *)(void *)mem;
+        mem += (max_bits * sizeof(int));
+    }
+
+    pool->n_cnt = (int)n_cnt;
+    pool->n_map = (int)(b_cnt / n_cnt);
+
+    pool->m_len = 0;
+    pool->m_page = (size_t)sysconf(_SC_PAGESIZE);
+    pool->m_back = !ptr ? MEMPOOL_BACK_HEAP : MEMPOOL_BACK_USER;
+    pool->m_span = span;
+    pool->m_seg = seg;
+    pool->m_color = colors;
+    pool->m_unit = unit;
+    pool->m_segs = b_cnt;
+    if (mapped)
+    {
+        if (!_mempool_map(pool, span))
+        {
+            spinlock_destroy(&pool->c_lock);
+            free(pool);
+            return NULL;
+        }
+
+        if (1 < pool->n_cnt)
+        {
+            _numa_bind(pool);
+        }
+
+        if (flags & MEMPOOL_PREFAULT)
+        {
+            _mempool_prefault(pool);
+        }
+    }
+    else
+    {
+        pool->mem = !ptr ? (char *)(((uintptr_t)mem + align - 1) & ~(uintptr_t)(align - 1)) : (char *)ptr;
+        if (!ptr)
+        {
+            mem = pool->mem + span;
+        }
+    }
+
+    /* 串起所有单元，初始状态均为空闲 */
+    pool->f_head = 0;
+    pool->f_state = NULL;
+    if (flags & MEMPOOL_FREELIST)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            *_freelist_next(pool, i) = (i + 1 < count) ? (i + 2) : 0;
+        }
+
+        pool->f_head = 1;
+        if (flags & MEMPOOL_DEBUG)
+        {
+            pool->f_state = (uint8_t *)mem;
+            (void)memset(pool->f_state, 0, count);
+        }
+    }
+
+    spinlock_init(&pool->wait.lock);
+    list_init(&pool->wait.head);
+    pool->wait.count = 0;
+
+    pool->stat.enable = false;
+    pool->stat.reset = stimer_getnanosec();
+    pool->stat.shard = NULL;
+    if (0 != posix_memalign((void **)&pool->stat.shard, CACHELINE_SIZE, STAT_SHARDS * sizeof(_mpstat_t)))
+    {
+        log_error("mempool: posix_memalign failed");
+        pool->stat.shard = NULL;
+        pool->flags &= ~MEMPOOL_MAGAZINE;
+        mempool_destroy(pool);
+        return NULL;
+    }
+
+    (void)memset(pool->stat.shard, 0, STAT_SHARDS * sizeof(_mpstat_t));
+
+    /* 缓存总量不超过单元总数的1/4，避免单元滞留在缓存中而其他线程申请不到；
+     * 单元太少时不启用线程缓存 */
+    if (flags & MEMPOOL_MAGAZINE)
+    {
+        pool->mag.size = count / (4 * (uint32_t)cpu);
+        pool->mag.size = (pool->mag.size > MAG_SIZE) ? MAG_SIZE : pool->mag.size;
+        pool->mag.batch = (pool->mag.size + 1) / 2;
+        if (0 == pool->mag.size)
+        {
+            pool->flags &= ~MEMPOOL_MAGAZINE;
+        }
+    }
+
+    if (pool->flags & MEMPOOL_MAGAZINE)
+    {
+        if (0 != pthread_key_create(&pool->mag.key, _magazine_exit))
+        {
+            log_error("mempool: create magazine key failed");
+            pool->flags &= ~MEMPOOL_MAGAZINE;
+            mempool_destroy(pool);
+            return NULL;
+        }
+
+        spinlock_init(&pool->mag.lock);
+        list_init(&pool->mag.head);
+    }
 
     /* 创建位图 */
     for (uint32_t i = 0; i < b_cnt; i++, pool->b_cnt++)
     {
-        pool->b_map[i] = bitmap_create((int)bits_in_map[i]);
+        pool->b_map[i] = bitmap_create_ex((int)bits_in_map[i],
+                                (flags & MEMPOOL_LOCKFREE) ? BITMAP_LOCKFREE : 0);
         if (NULL == pool->b_map[i])
         {
             log_error("mempool: create bitmap(%u,%u) failed",
                         i, bits_in_map[i]);
 
-            _mempool_destroy_bitmap(pool);
-            free(pool);
-            pool = NULL;
-            break;
+            mempool_destroy(pool);
+            return NULL;
         }
     }
 
+    (void)snprintf(pool->name, sizeof(pool->name), "mp@%p", (void *)pool);
+    mpstat_register(pool->name, pool);
     return pool;
 }
 
+mempool_t *mempool_create(uint32_t size, uint32_t count, void *ptr)
+{
+    return mempool_create_ex(size, count, ptr, 0);
+}
+
 void mempool_destroy(mempool_t *pool)
 {
     if (NULL == pool)
@@ -170,57 +1455,153 @@ void mempool_destroy(mempool_t *pool)
         return;
     }
 
+    mpstat_unregister(pool->name, pool);
+
+    if (pool->flags & MEMPOOL_MAGAZINE)
+    {
+        _magazine_destroy(pool);
+    }
+
     _mempool_destroy_bitmap(pool);
+    free(pool->stat.shard);
+    spinlock_destroy(&pool->wait.lock);
+    spinlock_destroy(&pool->c_lock);
+    if (0 != pool->m_len)
+    {
+        (void)munmap(pool->mem, pool->m_len);
+    }
+
     free(pool);
 }
 
 void *mempool_alloc(mempool_t *pool)
 {
-    void *mem = NULL;
+    uint64_t begin = _stat_begin(pool);
+    void *mem = (pool->flags & MEMPOOL_MAGAZINE) ? _magazine_alloc(pool) : _mempool_malloc(pool);
+    if (NULL == mem)
+    {
+        mem = _mempool_wait(pool);
+    }
+
+    _debug_alloc(pool, mem);
+    _stat_alloc(pool, mem, begin);
+    return mem;
+}
+
+void *mempool_try_alloc(mempool_t *pool)
+{
+    uint64_t begin = _stat_begin(pool);
+    void *mem = (pool->flags & MEMPOOL_MAGAZINE) ? _magazine_alloc(pool) : _mempool_malloc(pool);
+    _debug_alloc(pool, mem);
+    _stat_alloc(pool, mem, begin);
+    return mem;
+}
 
-    sema_t sem;
-    sema_init(sem);
-    for (uint32_t tw = MIN_WAIT; tw < MAX_WAIT; tw <<= 1)
+void mempool_free(mempool_t *pool, void *mem)
+{
+    if (!_mempool_owned(pool, mem))
     {
-        mem = _mempool_malloc(pool);
-        if (NULL != mem)
+        log_error("mempool: %p not in mempool", mem);
+        return;
+    }
+
+    _debug_free(pool, mem);
+    _stat_add(&_stat_shard(pool)->free, 1);
+
+    if (pool->flags & MEMPOOL_MAGAZINE)
+    {
+        _magazine_t *mag = _magazine_get(pool);
+
+        /* 有等待者时直接归还位图并交付，缓存中的单元也一并归还 */
+        if (0 != atomic_u32_fetch(&pool->wait.count))
         {
-            break;
+            if (NULL != mag)
+            {
+                _magazine_flush(mag, mag->count);
+            }
         }
+        else if (NULL != mag)
+        {
+            if (mag->count >= pool->mag.size)
+            {
+                _magazine_flush(mag, pool->mag.batch);
+            }
 
-        sema_msleep(sem, tw);
+            mag->slot[mag->count++] = mem;
+            return;
+        }
     }
 
-    sema_fini(sem);
-    return mem;
+    _mempool_release(pool, mem);
 }
 
-void mempool_free(mempool_t *mempool, void *mem)
+uint32_t mempool_alloc_bulk(mempool_t *pool, uint32_t n, void **out)
 {
-    /* 计算内存块所在的位置 */
-    int bit = (int)(((char *)mem - mempool->mem) / (int)mempool->fix_size);
-    if ((bit < 0) || (bit >= (int)mempool->max))
+    uint32_t got = _mempool_malloc_bulk(pool, out, n);
+    for (uint32_t i = 0; i < got; i++)
     {
-        log_error("mempool: %p not in mempool", mem);
-        return;
+        _debug_alloc(pool, out[i]);
     }
 
-    /* 计算位图位置 */
-    int idx = bit / mempool->b_avg;
-    bit %= mempool->b_avg;
-    if (idx > mempool->b_cnt - 1)
+    _mpstat_t *stat = _stat_shard(pool);
+    _stat_add(&stat->alloc, got);
+    if (got < n)
     {
-        idx = mempool->b_cnt - 1;
-        bit += mempool->b_avg;
+        _stat_add(&stat->fail, 1);
     }
 
-    if (0 != bitmap_freebit(mempool->b_map[idx], bit))
+    return got;
+}
+
+void mempool_free_bulk(mempool_t *pool, uint32_t n, void **ptrs)
+{
+    for (uint32_t i = 0; i < n; i++)
     {
-        log_error("mempool: may be double-free");
-        abort();
+        if (!_mempool_owned(pool, ptrs[i]))
+        {
+            log_error("mempool: %p not in mempool", ptrs[i]);
+            return;
+        }
+    }
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        _debug_free(pool, ptrs[i]);
+    }
+
+    _stat_add(&_stat_shard(pool)->free, n);
+
+    if (pool->flags & MEMPOOL_FREELIST)
+    {
+        for (uint32_t i = 0; i < n; i++)
+        {
+            _mempool_release(pool, ptrs[i]);
+        }
+
+        return;
+    }
+
+    _mempool_release_bulk(pool, ptrs, n);
+}
+
+bool mempool_owned(mempool_t *pool, const void *mem)
+{
+    return _mempool_owned(pool, mem);
+}
+
+void mempool_trim(mempool_t *pool)
+{
+    if (pool->flags & MEMPOOL_GROWABLE)
+    {
+        _chunk_shrink(pool, stimer_getnanosec());
     }
+}
 
-    (void)atomic_u32_dec(&mempool->used);
+void mempool_setname(mempool_t *pool, const char *name)
+{
+    mpstat_unregister(pool->name, pool);
+    (void)snprintf(pool->name, sizeof(pool->name), "%s", name);
+    mpstat_register(pool->name, pool);
 }
 
 /*************************************************************************
@@ -230,5 +1611,106 @@ void mempool_getinfo(mempool_t *mempool, mempool_info_t *info)
 {
     info->fix_size = mempool->fix_size;
     info->total = mempool->max;
-    info->used = mempool->used;
-}
\ No newline at end of file
+    info->cached = 0;
+    info->active = mempool->max;
+    info->backing = mempool->m_back;
+    info->nodes = (uint32_t)mempool->n_cnt;
+
+    if (mempool->flags & MEMPOOL_GROWABLE)
+    {
+        info->active = 0;
+        int act = atomic_s32_fetch(&mempool->c_act);
+        for (int i = 0; i < act; i++)
+        {
+            info->active += mempool->c_info[i].bits;
+        }
+    }
+
+    /* 线程缓存的计数由所属线程修改，这里只做近似统计 */
+    if (mempool->flags & MEMPOOL_MAGAZINE)
+    {
+        list_head_t *pos;
+        spinlock_lock(&mempool->mag.lock);
+        list_foreach(pos, &mempool->mag.head)
+        {
+            info->cached += container_of(pos, _magazine_t, link)->count;
+        }
+        spinlock_unlock(&mempool->mag.lock);
+    }
+
+    uint32_t used = atomic_u32_fetch(&mempool->used);
+    info->used = (used > info->cached) ? (used - info->cached) : 0;
+}
+
+/*************************************************************************
+*************************************************************************/
+
+void mempool_getstatis(mempool_t *pool, mp_info_t *info)
+{
+    (void)memset(info, 0, sizeof(mp_info_t));
+    mempool_getinfo(pool, &info->base);
+    info->elapsed = (stimer_getnanosec() - atomic_u64_fetch(&pool->stat.reset)) / 1000000;
+
+    for (uint32_t i = 0; i < STAT_SHARDS; i++)
+    {
+        _mpstat_t *stat = &pool->stat.shard[i];
+        info->alloc += __atomic_load_n(&stat->alloc, __ATOMIC_RELAXED);
+        info->free += __atomic_load_n(&stat->free, __ATOMIC_RELAXED);
+        info->fail += __atomic_load_n(&stat->fail, __ATOMIC_RELAXED);
+        info->wait += __atomic_load_n(&stat->wait, __ATOMIC_RELAXED);
+        info->timeout += __atomic_load_n(&stat->timeout, __ATOMIC_RELAXED);
+        info->contended += __atomic_load_n(&stat->contended, __ATOMIC_RELAXED);
+        for (int j = 0; j < MP_HIST_BUCKETS; j++)
+        {
+            info->hist[j] += __atomic_load_n(&stat->hist[j], __ATOMIC_RELAXED);
+        }
+    }
+
+    /* 位图占用包含线程缓存中的单元 */
+    info->maps = (pool->b_cnt > MP_MAPS) ? MP_MAPS : (uint32_t)pool->b_cnt;
+    for (uint32_t i = 0; i < info->maps; i++)
+    {
+        bitmap_info_t bits = {0};
+        bitmap_getinfo(pool->b_map[i], &bits);
+        info->map[i].total = (uint32_t)bits.total;
+        info->map[i].used = (uint32_t)bits.used;
+        info->map[i].contended = bits.contended;
+        info->contended += bits.contended;
+    }
+}
+
+/* 与计数并发时可能漏掉少量计数 */
+void mempool_resetstatis(mempool_t *pool)
+{
+    for (uint32_t i = 0; i < STAT_SHARDS; i++)
+    {
+        _mpstat_t *stat = &pool->stat.shard[i];
+        __atomic_store_n(&stat->alloc, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stat->free, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stat->fail, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stat->wait, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stat->timeout, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stat->contended, 0, __ATOMIC_RELAXED);
+        for (int j = 0; j < MP_HIST_BUCKETS; j++)
+        {
+            __atomic_store_n(&stat->hist[j], 0, __ATOMIC_RELAXED);
+        }
+    }
+
+    for (int i = 0; i < pool->b_cnt; i++)
+    {
+        bitmap_resetinfo(pool->b_map[i]);
+    }
+
+    atomic_u64_store(&pool->stat.reset, stimer_getnanosec());
+}
+
+void mempool_setstat(mempool_t *pool, bool enable)
+{
+    atomic_bool_store(&pool->stat.enable, enable);
+}
+
+bool mempool_getstat(mempool_t *pool)
+{
+    return atomic_bool_fetch(&pool->stat.enable);
+}
@@ -12,6 +12,7 @@
 #include <semaphore.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 
 /*************************************************************************
 *************************************************************************/
@@ -35,9 +36,11 @@ typedef struct
     int         (*up)(void *sem);
     int         (*down)(void *sem);
     void        (*sleep)(uint32_t ms);
+    int         (*timeddown)(void *sem, uint32_t ms);
 }_sem_ops_t;
 
 static _sem_ops_t g_sem_ops = {NULL};
+static __thread uintptr_t g_sem_site = 0;
 
 /*************************************************************************
 *************************************************************************/
@@ -47,7 +50,8 @@ int sema_register(int       (*special)(void),
                     int     (*fini)(void *sem),
                     int     (*up)(void *sem),
                     int     (*down)(void *sem),
-                    void    (*sleep)(uint32_t ms))
+                    void    (*sleep)(uint32_t ms),
+                    int     (*timeddown)(void *sem, uint32_t ms))
 {
     if ((NULL == init)
         || (NULL == fini)
@@ -64,6 +68,7 @@ int sema_register(int       (*special)(void),
         g_sem_ops.up = up;
         g_sem_ops.down = down;
         g_sem_ops.sleep = sleep;
+        g_sem_ops.timeddown = timeddown;
 
         return 0;
 }
@@ -159,6 +164,7 @@ void sema_down(sema_t sem)
 
     if (local->flag)
     {
+        g_sem_site = (uintptr_t)__builtin_return_address(0);
         int ret = g_sem_ops.down(local->pad);
         if (0 != ret)
         {
@@ -184,12 +190,81 @@ void sema_down(sema_t sem)
     }
 }
 
+static inline int _sema_timedwait(_sem_t *local, uint32_t ms)
+{
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+
+    int ret = 0;
+    do
+    {
+        ret = sem_timedwait((sem_t *)(void *)local->pad, &ts);
+    } while ((0 != ret) && (EINTR == errno));
+
+    if (0 != ret)
+    {
+        if (ETIMEDOUT != errno)
+        {
+            log_warn("sem_timedwait(%p) failed, error(%s)", local->pad, strerror(errno));
+        }
+
+        return ETIMEDOUT;
+    }
+
+    while (!atomic_s32_cas(&local->cond, COND_DONE, COND_WAIT, NULL))
+    {
+        sched_yield();
+    }
+
+    return 0;
+}
+
+int sema_timeddown(sema_t sem, uint32_t ms)
+{
+    _sem_t *local = (_sem_t *)(void *)sem;
+
+    if (!local->flag)
+    {
+        return _sema_timedwait(local, ms);
+    }
+
+    g_sem_site = (uintptr_t)__builtin_return_address(0);
+
+    /* 未注册限时等待时退化为一直等待(sema_register时timeddown为NULL) */
+    if (NULL == g_sem_ops.timeddown)
+    {
+        int ret = g_sem_ops.down(local->pad);
+        if (0 != ret)
+        {
+            log_warn("down(%p) failed, error(%s)", local->pad, strerror(ret));
+        }
+
+        return 0;
+    }
+
+    int ret = g_sem_ops.timeddown(local->pad, ms);
+    if ((0 != ret) && (ETIMEDOUT != ret))
+    {
+        log_warn("timeddown(%p) failed, error(%s)", local->pad, strerror(ret));
+    }
+
+    return ret;
+}
+
 void sema_msleep(sema_t sem, uint32_t ms)
 {
     _sem_t *local = (_sem_t *)(void *)sem;
 
     if (local->flag)
     {
+        g_sem_site = (uintptr_t)__builtin_return_address(0);
         g_sem_ops.sleep(ms);
     }
     else
@@ -197,3 +272,10 @@ void sema_msleep(sema_t sem, uint32_t ms)
         usleep(ms * 1000);
     }
 }
+
+uintptr_t sema_waitsite(void)
+{
+    uintptr_t site = g_sem_site;
+    g_sem_site = 0;
+    return site;
+}
@@ -0,0 +1,352 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Created by Hongbo Li <lihb2113@outlook.com>
+ */
+#include "slab.h"
+#include "mempool.h"
+#include "spinlock.h"
+#include "atomic.h"
+#include "list.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/*************************************************************************
+*************************************************************************/
+
+#define SMALL_MAX       128U    /* 小规格上限，以16字节递增 */
+#define SMALL_CLASSES   9U      /* 8,16,32,...,128 */
+#define GROUP_SPLIT     4U      /* 之后每个2倍区间分为4个规格 */
+#define GROUP_SHIFT     7       /* 第一个区间为(128,256] */
+#define SLAB_CLASSES    (SMALL_CLASSES + GROUP_SPLIT * 5U)  /* 最大规格4096 */
+#define SLAB_POOLS      16U     /* 每个规格最多的mempool数量 */
+#define TCACHE_SIZE     16U     /* 线程缓存每个规格的容量 */
+#define TCACHE_BATCH    (TCACHE_SIZE / 2)
+
+typedef struct
+{
+    uint32_t        size;               /* 规格大小 */
+    uint32_t        count;              /* 已创建的mempool数量 */
+    spinlock_t      lock;               /* 扩展时加锁 */
+    mempool_t      *pool[SLAB_POOLS];   /* 后创建的容量更大，优先使用 */
+}_bin_t;
+
+typedef struct
+{
+    list_head_t     link;
+    slab_t         *slab;
+    struct
+    {
+        uint32_t    count;
+        void       *slot[TCACHE_SIZE];
+    }bin[SLAB_CLASSES];
+}_tcache_t;
+
+struct slab
+{
+    uint32_t        count;              /* 首个mempool的单元数 */
+
+    struct
+    {
+        pthread_key_t   key;
+        spinlock_t      lock;
+        list_head_t     head;           /* 所有线程缓存，销毁时释放 */
+    }tcache;
+
+    _bin_t          bin[SLAB_CLASSES];
+};
+
+/*************************************************************************
+*************************************************************************/
+
+static inline uint32_t _slab_class(size_t size)
+{
+    if (size <= 8)
+    {
+        return 0;
+    }
+
+    if (size <= SMALL_MAX)
+    {
+        return (uint32_t)((size + 15) / 16);
+    }
+
+    /* size位于(2^k, 2^(k+1)]，区间内按1/4步长划分 */
+    uint32_t k = 63U - (uint32_t)__builtin_clzl((unsigned long)(size - 1));
+    size_t base = (size_t)1 << k;
+    size_t step = base / GROUP_SPLIT;
+    return SMALL_CLASSES + (k - GROUP_SHIFT) * GROUP_SPLIT + (uint32_t)((size - 1 - base) / step);
+}
+
+static inline uint32_t _slab_class_size(uint32_t idx)
+{
+    if (idx < SMALL_CLASSES)
+    {
+        return (0 == idx) ? 8 : idx * 16;
+    }
+
+    uint32_t j = idx - SMALL_CLASSES;
+    uint32_t base = 1U << (GROUP_SHIFT + j / GROUP_SPLIT);
+    return base + (j % GROUP_SPLIT + 1) * (base / GROUP_SPLIT);
+}
+
+/*************************************************************************
+*************************************************************************/
+
+static void *_bin_alloc(slab_t *slab, _bin_t *bin)
+{
+    for (;;)
+    {
+        uint32_t count = atomic_u32_fetch(&bin->count);
+        for (uint32_t i = count; i > 0; i--)
+        {
+            void *mem = mempool_try_alloc(bin->pool[i - 1]);
+            if (NULL != mem)
+            {
+                return mem;
+            }
+        }
+
+        if (SLAB_POOLS == count)
+        {
+            return NULL;
+        }
+
+        /* 全部用尽时扩展一个mempool，并发扩展时只有一个生效 */
+        spinlock_lock(&bin->lock);
+        if (count == bin->count)
+        {
+            /* 容量逐个翻倍，超过uint32范围时不再增长 */
+            uint64_t cap = (uint64_t)slab->count << count;
+            uint32_t n = (cap > UINT32_MAX) ? UINT32_MAX : (uint32_t)cap;
+            mempool_t *pool = mempool_create_ex(bin->size, n, NULL, MEMPOOL_FREELIST);
+            if (NULL == pool)
+            {
+                spinlock_unlock(&bin->lock);
+                log_error("slab: create pool(%u,%u) failed", bin->size, n);
+                return NULL;
+            }
+
+            bin->pool[count] = pool;
+            atomic_u32_store(&bin->count, count + 1);
+        }
+        spinlock_unlock(&bin->lock);
+    }
+}
+
+static void _bin_free(_bin_t *bin, void *mem)
+{
+    uint32_t count = atomic_u32_fetch(&bin->count);
+    for (uint32_t i = count; i > 0; i--)
+    {
+        if (mempool_owned(bin->pool[i - 1], mem))
+        {
+            mempool_free(bin->pool[i - 1], mem);
+            return;
+        }
+    }
+
+    log_error("slab: %p not in class %u", mem, bin->size);
+}
+
+/*************************************************************************
+*************************************************************************/
+
+/* 归还最早放入的count个单元 */
+static void _tcache_flush(_tcache_t *tc, uint32_t idx, uint32_t count)
+{
+    _bin_t *bin = &tc->slab->bin[idx];
+    for (uint32_t i = 0; i < count; i++)
+    {
+        _bin_free(bin, tc->bin[idx].slot[i]);
+    }
+
+    tc->bin[idx].count -= count;
+    (void)memmove(tc->bin[idx].slot, tc->bin[idx].slot + count,
+                    tc->bin[idx].count * sizeof(void *));
+}
+
+static void _tcache_exit(void *args)
+{
+    _tcache_t *tc = (_tcache_t *)args;
+    slab_t *slab = tc->slab;
+
+    for (uint32_t i = 0; i < SLAB_CLASSES; i++)
+    {
+        _tcache_flush(tc, i, tc->bin[i].count);
+    }
+
+    spinlock_lock(&slab->tcache.lock);
+    list_del(&tc->link);
+    spinlock_unlock(&slab->tcache.lock);
+    free(tc);
+}
+
+static _tcache_t *_tcache_get(slab_t *slab)
+{
+    _tcache_t *tc = (_tcache_t *)pthread_getspecific(slab->tcache.key);
+    if (NULL != tc)
+    {
+        return tc;
+    }
+
+    /* 失败时退化为直接访问mempool */
+    tc = (_tcache_t *)calloc(1, sizeof(_tcache_t));
+    if (NULL == tc)
+    {
+        return NULL;
+    }
+
+    tc->slab = slab;
+    if (0 != pthread_setspecific(slab->tcache.key, tc))
+    {
+        free(tc);
+        return NULL;
+    }
+
+    spinlock_lock(&slab->tcache.lock);
+    list_add_tail(&tc->link, &slab->tcache.head);
+    spinlock_unlock(&slab->tcache.lock);
+    return tc;
+}
+
+/*************************************************************************
+*************************************************************************/
+
+slab_t *slab_create(uint32_t count)
+{
+    if (0 == count)
+    {
+        log_error("slab: count is 0");
+        return NULL;
+    }
+
+    slab_t *slab = (slab_t *)calloc(1, sizeof(slab_t));
+    if (NULL == slab)
+    {
+        log_error("slab: malloc failed");
+        return NULL;
+    }
+
+    if (0 != pthread_key_create(&slab->tcache.key, _tcache_exit))
+    {
+        log_error("slab: create tcache key failed");
+        free(slab);
+        return NULL;
+    }
+
+    slab->count = count;
+    spinlock_init(&slab->tcache.lock);
+    list_init(&slab->tcache.head);
+
+    /* mempool在首次申请时创建 */
+    for (uint32_t i = 0; i < SLAB_CLASSES; i++)
+    {
+        slab->bin[i].size = _slab_class_size(i);
+        slab->bin[i].count = 0;
+        spinlock_init(&slab->bin[i].lock);
+    }
+
+    return slab;
+}
+
+void slab_destroy(slab_t *slab)
+{
+    if (NULL == slab)
+    {
+        return;
+    }
+
+    /* 线程缓存中的单元随mempool一起释放 */
+    (void)pthread_key_delete(slab->tcache.key);
+
+    list_head_t *pos, *next;
+    list_foreach_safe(pos, next, &slab->tcache.head)
+    {
+        list_del(pos);
+        free(container_of(pos, _tcache_t, link));
+    }
+
+    spinlock_destroy(&slab->tcache.lock);
+
+    for (uint32_t i = 0; i < SLAB_CLASSES; i++)
+    {
+        for (uint32_t j = 0; j < slab->bin[i].count; j++)
+        {
+            mempool_destroy(slab->bin[i].pool[j]);
+        }
+
+        spinlock_destroy(&slab->bin[i].lock);
+    }
+
+    free(slab);
+}
+
+void *slab_alloc(slab_t *slab, size_t size)
+{
+    if (size > SLAB_MAX_SIZE)
+    {
+        return malloc(size);
+    }
+
+    uint32_t idx = _slab_class(size);
+    _bin_t *bin = &slab->bin[idx];
+    _tcache_t *tc = _tcache_get(slab);
+    if (NULL == tc)
+    {
+        return _bin_alloc(slab, bin);
+    }
+
+    /* 线程缓存为空时才补充一批 */
+    if (0 == tc->bin[idx].count)
+    {
+        while (tc->bin[idx].count < TCACHE_BATCH)
+        {
+            void *mem = _bin_alloc(slab, bin);
+            if (NULL == mem)
+            {
+                break;
+            }
+
+            tc->bin[idx].slot[tc->bin[idx].count++] = mem;
+        }
+    }
+
+    return (0 != tc->bin[idx].count) ? tc->bin[idx].slot[--(tc->bin[idx].count)] : NULL;
+}
+
+void slab_free(slab_t *slab, void *mem, size_t size)
+{
+    if (NULL == mem)
+    {
+        return;
+    }
+
+    if (size > SLAB_MAX_SIZE)
+    {
+        free(mem);
+        return;
+    }
+
+    uint32_t idx = _slab_class(size);
+    _tcache_t *tc = _tcache_get(slab);
+    if (NULL == tc)
+    {
+        _bin_free(&slab->bin[idx], mem);
+        return;
+    }
+
+    if (TCACHE_SIZE == tc->bin[idx].count)
+    {
+        _tcache_flush(tc, idx, TCACHE_BATCH);
+    }
+
+    tc->bin[idx].slot[tc->bin[idx].count++] = mem;
+}
+
+size_t slab_usable(size_t size)
+{
+    return (size > SLAB_MAX_SIZE) ? size : _slab_class_size(_slab_class(size));
+}
@@ -7,11 +7,15 @@
 #include "log.h"
 
 #include <string.h>
+#include <stdlib.h>
 #include <map>
 #include <string>
+#include <vector>
+#include <algorithm>
 
 #define COSTAT_CMD      "costat"
 #define COSTAT_ARGC     2
+#define COSTAT_SARGC    3
 #define COCOUNT         6
 
 static const char * const lwt_op[] =
@@ -22,6 +26,14 @@ static const char * const lwt_op[] =
     [LwtSemup]      = "LwtSemup"
 };
 
+static const char * const block_kind[] =
+{
+    [BlockSem]      = "Sem",
+    [BlockSleep]    = "Sleep",
+    [BlockYield]    = "Yield",
+    [BlockSelect]   = "Select"
+};
+
 /*************************************************************************
 *************************************************************************/
 
@@ -46,10 +58,11 @@ class CostatMgr
                 uint64_t avg = (0 == end) ? 0 : info->lwt.op[i].delay / end;
 
                 (i == LwtQue) ?
-                    print("| %-10s | %-10s | %8lu | %8lu | %10lu |",
-                        name, lwt_op[i], doing, avg, info->lwt.op[i].max) :
-                    print("| %-10s | %-10s | %8lu | %8lu | %10lu |",
-                        "  ", lwt_op[i], doing, avg, info->lwt.op[i].max);
+                    print("| %-10s | %-5s | %-10s | %8lu | %8lu | %10lu |",
+                        name, comgr_getstat(mgr) ? "on" : "off",
+                        lwt_op[i], doing, avg, info->lwt.op[i].max) :
+                    print("| %-10s | %-5s | %-10s | %8lu | %8lu | %10lu |",
+                        "  ", " ", lwt_op[i], doing, avg, info->lwt.op[i].max);
             }
         }
 
@@ -79,6 +92,77 @@ class CostatMgr
             }
         }
 
+        static void printStack(const char *name,
+                            comgr_t *mgr,
+                            void (*print)(const char *, ...))
+        {
+            const coinfo_t *info = comgr_getinfo(mgr);
+            print("| %-10s | %6u | %6u | %10lu | %10lu | %10lu |",
+                name, info->stack.size, info->stack.sample, info->stack.count,
+                info->stack.max, info->stack.recommend);
+
+            for (int i = 0; i < STACK_BUCKETS; i++)
+            {
+                if (0 == info->stack.hist[i])
+                {
+                    continue;
+                }
+
+                print("| %-10s | %6s | %6s | <=%8luB | %10lu | %10s |",
+                    " ", " ", " ", 256UL << i, info->stack.hist[i], " ");
+            }
+        }
+
+        static void printWatchdog(const char *name,
+                                comgr_t *mgr,
+                                void (*print)(const char *, ...))
+        {
+            const coinfo_t *info = comgr_getinfo(mgr);
+            print("| %-10s | %6u | %6u | %18s | %10s | %10s |",
+                name, info->watchdog.slice, info->watchdog.threshold, " ", " ", " ");
+
+            for (uint32_t i = 0; i < info->watchdog.count; i++)
+            {
+                print("| %-10s | %6s | %6s | 0x%016lx | %10lu | %10lu |",
+                    " ", " ", " ", info->watchdog.lwt[i].func,
+                    info->watchdog.lwt[i].times, info->watchdog.lwt[i].max);
+            }
+        }
+
+        static void printBlock(const char *name,
+                            comgr_t *mgr,
+                            void (*print)(const char *, ...))
+        {
+            /* 当前阻塞数多的排在前面，其次按总阻塞时间 */
+            const coinfo_t *info = comgr_getinfo(mgr);
+            std::vector<coblock_t> sites(info->block.site, info->block.site + info->block.count);
+            if ((0 != info->block.site[BLOCK_SITES].count) || (0 != info->block.site[BLOCK_SITES].waiting))
+            {
+                sites.push_back(info->block.site[BLOCK_SITES]);
+            }
+
+            std::sort(sites.begin(), sites.end(),
+                [](const coblock_t &a, const coblock_t &b) {
+                    return (a.waiting != b.waiting) ? (a.waiting > b.waiting) : (a.total > b.total);
+                });
+
+            print("| %-10s | %6s | %18s | %7s | %10s | %12s | %10s |",
+                name, " ", " ", " ", " ", " ", " ");
+            for (auto iter = sites.begin(); iter != sites.end(); ++iter)
+            {
+                if (0 == iter->site)
+                {
+                    print("| %-10s | %6s | %18s | %7d | %10lu | %12lu | %10lu |",
+                        " ", "-", "others", iter->waiting, iter->count, iter->total, iter->max);
+                    continue;
+                }
+
+                print("| %-10s | %6s | 0x%016lx | %7d | %10lu | %12lu | %10lu |",
+                    " ", (iter->kind < BlockEnd) ? block_kind[iter->kind] : "?",
+                    iter->site, iter->waiting, iter->count, iter->total, iter->max);
+            }
+        }
+
     public:
 
         static void Register(const char *name, comgr_t *mgr)
@@ -120,16 +204,45 @@ class CostatMgr
             }
         }
 
+        static void SampleAll(uint32_t sample)
+        {
+            for (auto iter = coMap.begin(); iter != coMap.end(); ++iter)
+            {
+                comgr_stacksample(iter->second, sample);
+            }
+        }
+
+        static void SwitchAll(bool enable)
+        {
+            for (auto iter = coMap.begin(); iter != coMap.end(); ++iter)
+            {
+                comgr_setstat(iter->second, enable);
+            }
+        }
+
+        static void PrintBlock(void (*print)(const char *, ...))
+        {
+            print("---------------------------------------------------------------------");
+            print("| %-10s | %6s | %18s | %7s | %10s | %12s | %10s |",
+                    "Name", "Type", "Site", "Waiting", "Count", "Total", "Max");
+            for (auto iter = coMap.begin(); iter != coMap.end(); ++iter)
+            {
+                print("|------------|--------|--------------------|---------|------------|--------------|------------|");
+                printBlock(iter->first.c_str(), iter->second, print);
+            }
+            print("---------------------------------------------------------------------");
+        }
+
         static void PrintAll(void (*print)(const char *, ...))
         {
             /* 1. 打印lwt延时统计信息 */
             print("---------------------------------------------------------------------");
-            print("| %-10s | %-10s | %8s | %8s | %10s |",
-                    "Name", "Operation", "Doing", "Average", "Max");
+            print("| %-10s | %-5s | %-10s | %8s | %8s | %10s |",
+                    "Name", "Stat", "Operation", "Doing", "Average", "Max");
 
             for (auto iter = coMap.begin(); iter != coMap.end(); ++iter)
             {
-                print("|------------|------------|------------|------------|------------|");
+                print("|------------|-------|------------|------------|------------|------------|");
                 printOp(iter->first.c_str(), iter->second, print);
             }
             print("---------------------------------------------------------------------");
@@ -143,6 +256,28 @@ class CostatMgr
                 printLwt(iter->first.c_str(), iter->second, print);
             }
             print("---------------------------------------------------------------------");
+
+            /* 3. 打印lwt栈水位信息 */
+            print("\n---------------------------------------------------------------------");
+            print("| %-10s | %6s | %6s | %10s | %10s | %10s |",
+                    "Name", "Stack", "Sample", "Count", "Max", "Recommend");
+            for (auto iter = coMap.begin(); iter != coMap.end(); ++iter)
+            {
+                print("|------------|--------|--------|------------|------------|------------|");
+                printStack(iter->first.c_str(), iter->second, print);
+            }
+            print("---------------------------------------------------------------------");
+
+            /* 4. 打印长时间运行的lwt */
+            print("\n---------------------------------------------------------------------");
+            print("| %-10s | %6s | %6s | %18s | %10s | %10s |",
+                    "Name", "Slice", "Limit", "Function", "Times", "Max");
+            for (auto iter = coMap.begin(); iter != coMap.end(); ++iter)
+            {
+                print("|------------|--------|--------|--------------------|------------|------------|");
+                printWatchdog(iter->first.c_str(), iter->second, print);
+            }
+            print("---------------------------------------------------------------------");
         }
 };
 
@@ -156,8 +291,14 @@ static void _costat_help(void *nouse, void (*print)(const char *, ...))
     print("Usage: "
             "\t%-10s %-10s{help information}\n"
             "\t%-10s %-10s{get statistic data}\n"
-            "\t%-10s %-10s{reset statistic data}\n",
-            COSTAT_CMD, "help", COSTAT_CMD, "get", COSTAT_CMD, "reset");
+            "\t%-10s %-10s{reset statistic data}\n"
+            "\t%-10s %-10s{enable statistic}\n"
+            "\t%-10s %-10s{disable statistic}\n"
+            "\t%-10s %-10s{sample stack depth every n lwts, 0 to disable}\n"
+            "\t%-10s %-10s{blocked lwts grouped by wait site, time in us}\n",
+            COSTAT_CMD, "help", COSTAT_CMD, "get", COSTAT_CMD, "reset",
+            COSTAT_CMD, "on", COSTAT_CMD, "off", COSTAT_CMD, "stack <n>",
+            COSTAT_CMD, "block");
 }
 
 static void _costat_func(void *nouse,
@@ -165,6 +306,12 @@ static void _costat_func(void *nouse,
                     int argc,
                     argv_t argv)
 {
+    if ((argc == COSTAT_SARGC) && (0 == strcasecmp(argv[1], "stack")))
+    {
+        CostatMgr::SampleAll((uint32_t)strtoul(argv[2], NULL, 0));
+        return;
+    }
+
     if (argc != COSTAT_ARGC)
     {
         _costat_help(nouse, print);
@@ -183,6 +330,24 @@ static void _costat_func(void *nouse,
         return;
     }
 
+    if (0 == strcasecmp(argv[1], "block"))
+    {
+        CostatMgr::PrintBlock(print);
+        return;
+    }
+
+    if (0 == strcasecmp(argv[1], "on"))
+    {
+        CostatMgr::SwitchAll(true);
+        return;
+    }
+
+    if (0 == strcasecmp(argv[1], "off"))
+    {
+        CostatMgr::SwitchAll(false);
+        return;
+    }
+
     _costat_help(nouse, print);
 }
 
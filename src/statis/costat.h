@@ -23,6 +23,19 @@ enum
     LwtEnd
 };
 
+enum
+{
+    BlockSem,           /* cosem_down */
+    BlockSleep,         /* cosem_sleep */
+    BlockYield,         /* coroutine_yield */
+    BlockSelect,        /* co_select */
+    BlockEnd
+};
+
+#define STACK_BUCKETS   16  /* 栈水位直方图档数，第i档上限为256<<i字节 */
+#define WATCHDOG_MAX    8   /* 看门狗记录的lwt函数数 */
+#define BLOCK_SITES     32  /* 阻塞点记录数，超出的计入最后一项 */
+
 typedef struct
 {
     uint64_t            begin;  /* 开始次数 */
@@ -31,6 +44,16 @@ typedef struct
     uint64_t            max;    /* 最大延时 */
 }lwtop_t;
 
+typedef struct
+{
+    uintptr_t           site;   /* 阻塞点(调用者返回地址)，0表示其他 */
+    uint32_t            kind;   /* 阻塞类型 */
+    int32_t             waiting;/* 当前阻塞的lwt数 */
+    uint64_t            count;  /* 已恢复的次数 */
+    uint64_t            total;  /* 总阻塞时间 */
+    uint64_t            max;    /* 最长阻塞时间 */
+}coblock_t;
+
 typedef struct
 {
     struct
@@ -45,10 +68,44 @@ typedef struct
         uint32_t        total;  /* worker的总数 */
         uint32_t       *count;  /* 每个worker上的lwt数 */
     }worker;
+
+    struct
+    {
+        uint32_t        size;       /* 当前栈大小 */
+        uint32_t        sample;     /* 采样间隔，0表示关闭 */
+        uint64_t        count;      /* 采样的lwt数 */
+        uint64_t        max;        /* 最大栈水位 */
+        uint64_t        recommend;  /* 推荐栈大小 */
+        uint64_t        hist[STACK_BUCKETS];    /* 栈水位分布 */
+    }stack;
+
+    struct
+    {
+        uint32_t        slice;      /* 时间片，毫秒 */
+        uint32_t        threshold;  /* 告警门限，毫秒 */
+        uint32_t        count;      /* 记录数 */
+        struct
+        {
+            uintptr_t   func;       /* lwt函数地址 */
+            uint64_t    times;      /* 超过门限的次数 */
+            uint64_t    max;        /* 最长运行时间，毫秒 */
+        }lwt[WATCHDOG_MAX];
+    }watchdog;
+
+    struct
+    {
+        uint32_t        count;      /* 记录数 */
+        coblock_t       site[BLOCK_SITES + 1];  /* 按阻塞点汇总，时间为微秒 */
+    }block;
 }coinfo_t;
 
 const coinfo_t *comgr_getinfo   (comgr_t    *mgr);
 void            comgr_resetinfo     (comgr_t *mgr);
+void            comgr_setstat       (comgr_t *mgr, bool enable);
+bool            comgr_getstat       (comgr_t *mgr);
+
+/* 每sample个lwt填充一次栈并在退出时测量水位，0表示关闭 */
+void            comgr_stacksample   (comgr_t *mgr, uint32_t sample);
 
 /*************************************************************************
 *************************************************************************/
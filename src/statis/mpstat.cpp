@@ -0,0 +1,263 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Created by Hongbo Li <lihb2113@outlook.com>
+ */
+#include "mpstat.h"
+#include "cmdline.h"
+#include "log.h"
+
+#include <string.h>
+#include <map>
+#include <mutex>
+#include <string>
+
+#define MPSTAT_CMD      "mpstat"
+#define MPSTAT_ARGC     2
+
+/*************************************************************************
+*************************************************************************/
+
+static void _mpstat_help(void *, void (*)(const char *, ...));
+static void _mpstat_func(void *, void (*)(const char *, ...), int, argv_t);
+
+class MpstatMgr
+{
+    private:
+        static std::map<std::string, mempool_t *> mpMap;
+        static std::mutex mpLock;   /* 内存池可在任意线程中创建销毁 */
+
+        static uint64_t perSecond(uint64_t count, uint64_t elapsed)
+        {
+            return (0 == elapsed) ? count : count * 1000 / elapsed;
+        }
+
+        static void printPool(const char *name,
+                            const mp_info_t *info,
+                            void (*print)(const char *, ...))
+        {
+            print("| %-12s | %6u | %8u | %8u | %6u | %9lu | %9lu | %8lu | %8lu | %8lu | %10lu |",
+                name, info->base.fix_size, info->base.total, info->base.used, info->base.cached,
+                perSecond(info->alloc, info->elapsed), perSecond(info->free, info->elapsed),
+                info->fail, info->wait, info->timeout, info->contended);
+        }
+
+        static void printMap(const char *name,
+                            const mp_info_t *info,
+                            void (*print)(const char *, ...))
+        {
+            print("| %-12s | %5s | %8s | %8s | %5s | %10s |", name, " ", " ", " ", " ", " ");
+            for (uint32_t i = 0; i < info->maps; i++)
+            {
+                const mp_map_t *map = &info->map[i];
+                print("| %-12s | %5u | %8u | %8u | %4u%% | %10lu |",
+                    " ", i, map->total, map->used,
+                    (0 == map->total) ? 0 : map->used * 100 / map->total, map->contended);
+            }
+        }
+
+        static void printLatency(const char *name,
+                                mempool_t *pool,
+                                const mp_info_t *info,
+                                void (*print)(const char *, ...))
+        {
+            uint64_t total = 0;
+            for (int i = 0; i < MP_HIST_BUCKETS; i++)
+            {
+                total += info->hist[i];
+            }
+
+            print("| %-12s | %-5s | %12s | %10s | %5s |",
+                name, mempool_getstat(pool) ? "on" : "off", " ", " ", " ");
+            for (int i = 0; i < MP_HIST_BUCKETS; i++)
+            {
+                if (0 == info->hist[i])
+                {
+                    continue;
+                }
+
+                (i == MP_HIST_BUCKETS - 1) ?
+                    print("| %-12s | %5s | >=%8luns | %10lu | %4lu%% |",
+                        " ", " ", 64UL << (i - 1), info->hist[i], info->hist[i] * 100 / total) :
+                    print("| %-12s | %5s | < %8luns | %10lu | %4lu%% |",
+                        " ", " ", 64UL << i, info->hist[i], info->hist[i] * 100 / total);
+            }
+        }
+
+    public:
+
+        static void Register(const char *name, mempool_t *pool)
+        {
+            std::lock_guard<std::mutex> guard(mpLock);
+            auto _md = mpMap.find(std::string(name));
+            if (_md != mpMap.end())
+            {
+                log_error("mod(%s) already registered", name);
+                return;
+            }
+
+            if (mpMap.empty())
+            {
+                cmd_register(MPSTAT_CMD, NULL, _mpstat_help, _mpstat_func);
+            }
+
+            mpMap[std::string(name)] = pool;
+        }
+
+        static void Unregister(const char *name, mempool_t *pool)
+        {
+            std::lock_guard<std::mutex> guard(mpLock);
+            auto _md = mpMap.find(std::string(name));
+            if ((_md == mpMap.end()) || (_md->second != pool))
+            {
+                return;
+            }
+
+            mpMap.erase(_md);
+            if (mpMap.empty())
+            {
+                cmd_unregister(MPSTAT_CMD);
+            }
+        }
+
+        static void ResetAll()
+        {
+            std::lock_guard<std::mutex> guard(mpLock);
+            for (auto iter = mpMap.begin(); iter != mpMap.end(); ++iter)
+            {
+                mempool_resetstatis(iter->second);
+            }
+        }
+
+        static void SwitchAll(bool enable)
+        {
+            std::lock_guard<std::mutex> guard(mpLock);
+            for (auto iter = mpMap.begin(); iter != mpMap.end(); ++iter)
+            {
+                mempool_setstat(iter->second, enable);
+            }
+        }
+
+        static void PrintMap(void (*print)(const char *, ...))
+        {
+            std::lock_guard<std::mutex> guard(mpLock);
+            mp_info_t info;
+            print("---------------------------------------------------------------------");
+            print("| %-12s | %5s | %8s | %8s | %5s | %10s |",
+                    "Name", "Map", "Total", "Used", "Usage", "Contended");
+            for (auto iter = mpMap.begin(); iter != mpMap.end(); ++iter)
+            {
+                mempool_getstatis(iter->second, &info);
+                print("|--------------|-------|----------|----------|-------|------------|");
+                printMap(iter->first.c_str(), &info, print);
+            }
+            print("---------------------------------------------------------------------");
+        }
+
+        static void PrintAll(void (*print)(const char *, ...))
+        {
+            std::lock_guard<std::mutex> guard(mpLock);
+            mp_info_t info;
+
+            /* 1. 打印单元占用与申请释放统计，速率为重置以来的平均值 */
+            print("---------------------------------------------------------------------");
+            print("| %-12s | %6s | %8s | %8s | %6s | %9s | %9s | %8s | %8s | %8s | %10s |",
+                    "Name", "Size", "Total", "Used", "Cached", "Alloc/s", "Free/s",
+                    "Fail", "Wait", "Timeout", "Contended");
+            for (auto iter = mpMap.begin(); iter != mpMap.end(); ++iter)
+            {
+                mempool_getstatis(iter->second, &info);
+                print("|--------------|--------|----------|----------|--------|-----------|"
+                        "-----------|----------|----------|----------|------------|");
+                printPool(iter->first.c_str(), &info, print);
+            }
+            print("---------------------------------------------------------------------");
+
+            /* 2. 打印申请延迟分布 */
+            print("\n---------------------------------------------------------------------");
+            print("| %-12s | %-5s | %12s | %10s | %5s |",
+                    "Name", "Stat", "Latency", "Count", "Pct");
+            for (auto iter = mpMap.begin(); iter != mpMap.end(); ++iter)
+            {
+                mempool_getstatis(iter->second, &info);
+                print("|--------------|-------|--------------|------------|-------|");
+                printLatency(iter->first.c_str(), iter->second, &info, print);
+            }
+            print("---------------------------------------------------------------------");
+        }
+};
+
+std::map<std::string, mempool_t *> MpstatMgr::mpMap;
+std::mutex MpstatMgr::mpLock;
+
+/*************************************************************************
+*************************************************************************/
+
+static void _mpstat_help(void *nouse, void (*print)(const char *, ...))
+{
+    print("Usage: "
+            "\t%-10s %-10s{help information}\n"
+            "\t%-10s %-10s{get statistic data}\n"
+            "\t%-10s %-10s{occupancy and lock contention per bitmap}\n"
+            "\t%-10s %-10s{reset statistic data}\n"
+            "\t%-10s %-10s{enable alloc latency statistic}\n"
+            "\t%-10s %-10s{disable alloc latency statistic}\n",
+            MPSTAT_CMD, "help", MPSTAT_CMD, "get", MPSTAT_CMD, "map",
+            MPSTAT_CMD, "reset", MPSTAT_CMD, "on", MPSTAT_CMD, "off");
+}
+
+static void _mpstat_func(void *nouse,
+                    void (*print)(const char *, ...),
+                    int argc,
+                    argv_t argv)
+{
+    if (argc != MPSTAT_ARGC)
+    {
+        _mpstat_help(nouse, print);
+        return;
+    }
+
+    if (0 == strcasecmp(argv[1], "get"))
+    {
+        MpstatMgr::PrintAll(print);
+        return;
+    }
+
+    if (0 == strcasecmp(argv[1], "map"))
+    {
+        MpstatMgr::PrintMap(print);
+        return;
+    }
+
+    if (0 == strcasecmp(argv[1], "reset"))
+    {
+        MpstatMgr::ResetAll();
+        return;
+    }
+
+    if (0 == strcasecmp(argv[1], "on"))
+    {
+        MpstatMgr::SwitchAll(true);
+        return;
+    }
+
+    if (0 == strcasecmp(argv[1], "off"))
+    {
+        MpstatMgr::SwitchAll(false);
+        return;
+    }
+
+    _mpstat_help(nouse, print);
+}
+
+/*************************************************************************
+*************************************************************************/
+
+void mpstat_register(const char *name, mempool_t *pool)
+{
+    MpstatMgr::Register(name, pool);
+}
+
+void mpstat_unregister(const char *name, mempool_t *pool)
+{
+    MpstatMgr::Unregister(name, pool);
+}
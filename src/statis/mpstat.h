@@ -0,0 +1,65 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Created by Hongbo Li <lihb2113@outlook.com>
+ */
+#ifndef __MEMPOOL_STAT_H__
+#define __MEMPOOL_STAT_H__
+
+#include "mempool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*************************************************************************
+*************************************************************************/
+
+#define MP_HIST_BUCKETS 16  /* 申请延迟直方图档数，第i档上限为64<<i纳秒 */
+#define MP_MAPS         64  /* 位图数上限 */
+
+typedef struct
+{
+    uint32_t            total;      /* 位图的单元数 */
+    uint32_t            used;       /* 已占用数(含线程缓存中的单元) */
+    uint64_t            contended;  /* 位图锁竞争次数 */
+}mp_map_t;
+
+typedef struct
+{
+    mempool_info_t      base;       /* mempool_getinfo的结果 */
+
+    uint64_t            elapsed;    /* 距上次重置的毫秒数 */
+    uint64_t            alloc;      /* 申请成功次数 */
+    uint64_t            free;       /* 释放次数 */
+    uint64_t            fail;       /* 申请失败次数(含等待超时) */
+    uint64_t            wait;       /* 耗尽后进入等待的次数 */
+    uint64_t            timeout;    /* 等待超时次数 */
+    uint64_t            contended;  /* 空闲链表CAS失败次数与位图锁竞争次数之和 */
+    uint64_t            hist[MP_HIST_BUCKETS];  /* 申请延迟分布，开启统计时记录 */
+
+    uint32_t            maps;       /* 位图数，空闲链表引擎为0 */
+    mp_map_t            map[MP_MAPS];
+}mp_info_t;
+
+void    mempool_getstatis   (mempool_t *pool, mp_info_t *info);
+void    mempool_resetstatis (mempool_t *pool);
+
+/* 计数始终记录，延迟直方图需要额外读时钟，默认关闭 */
+void    mempool_setstat     (mempool_t *pool, bool enable);
+bool    mempool_getstat     (mempool_t *pool);
+
+/*************************************************************************
+*************************************************************************/
+
+/* 由mempool_create_ex/mempool_destroy/mempool_setname调用，只注销name对应的pool本身 */
+void    mpstat_register     (const char *name, mempool_t *pool);
+void    mpstat_unregister   (const char *name, mempool_t *pool);
+
+/*************************************************************************
+*************************************************************************/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
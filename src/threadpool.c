@@ -55,6 +55,7 @@ typedef struct
 
     pthread_t       id;
     bool            is_run;
+    bool            sleeping;
     sem_t           sem;
 
     uint32_t        jobs;
@@ -136,10 +137,19 @@ static void *_threadraw_svc(void *args)
     {
         while (raw->need_sleep(raw->args))
         {
+            /* 先标记睡眠再复查条件，与threadraw_wakeup配合保证不丢失唤醒 */
+            atomic_bool_store(&raw->thd.sleeping, true);
+            if (!raw->need_sleep(raw->args))
+            {
+                atomic_bool_store(&raw->thd.sleeping, false);
+                break;
+            }
+
             struct timespec ts;
             _sem_wait_time(&ts);
 
             (void)sem_timedwait(&raw->thd.sem, &ts);
+            atomic_bool_store(&raw->thd.sleeping, false);
             if (atomic_bool_cas(&raw->thd.is_run, false, false, NULL))
             {
                 return NULL;
@@ -215,6 +225,7 @@ static int _thread_start(_thread_t *thread,
     list_init(&thread->wait.list);
 
     thread->is_run = true;
+    thread->sleeping = false;
     if (0 != sem_init(&thread->sem, 0, 0))
     {
         log_fatal("sem_init failed, errno=%d", errno);
@@ -327,6 +338,12 @@ void threadraw_destroy(threadraw_t *raw)
 
 void threadraw_wakeup(threadraw_t *raw)
 {
+    /* 线程未睡眠时会自行复查need_sleep，无需sem_post */
+    if (!atomic_bool_fetch(&raw->thd.sleeping))
+    {
+        return;
+    }
+
     int val = 0;
     (void)sem_getvalue(&raw->thd.sem, &val);
     if (val < SEM_POST_MAX)